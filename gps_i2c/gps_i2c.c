@@ -23,10 +23,12 @@
 #include <string.h>
 #include <avr/io.h>
 #include <util/delay.h>
+#include <util/atomic.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
 
 #include <uart.h>
+#include <uart_log.h>
 #include <i2c.h>
 #include <rtc.h>
 #include <nmea.h>
@@ -37,18 +39,52 @@
 //#define NMEA_DEBUG_GSA
 //#define NMEA_DEBUG_GSV
 
+/* Mirror the raw NMEA sentences from the GPS to the console */
+//#define GPS_PASSTHROUGH
+
 uart_t *u0;
 uart_t *u1;
+unsigned char log_buffer[512];
 uint16_t current_time_ms = 0, last_time_ms = 0;
-struct {
+
+/*
+ * The I2C registers read by the master, from a snapshot of the GPS state
+ * published by the main loop.
+ */
+typedef struct _gps_data_t
+{
   rtc_datetime_24h_t current_dt;
   uint8_t gps_signal_strength;
-} data;
-uint8_t *data_p;
+} gps_data_t;
+
+gps_data_t gps_data[2];
+i2c_registers_t gps_registers;
 uint8_t gps_uart_data_ready = 0;
+#if UART_RX_TIMESTAMPS
+/*
+ * With the UART library built with -DUART_RX_TIMESTAMPS=1
+ * -DUART_RX_TIMESTAMP_COUNTER=TCNT1, sentences are timestamped by Timer1,
+ * running free at F_CPU/1024, and compared to the last PPS pulse.
+ */
+#define GPS_TICKS_TO_MS(t) ((uint16_t)((uint32_t)(t) * 1024 / (F_CPU / 1000)))
+volatile uint16_t pps_timestamp = 0;
+#endif
 uint8_t nmea_sentence_ready = 0;
+
+/*
+ * NMEA sentences (up to 82 characters) are received in line mode, directly
+ * from the UART's receive buffer, when its line slots are large enough for
+ * them; that requires the UART library to be built with
+ * -DUART1_RX_BUFFER_SIZE=256 with the default two line slots.  Otherwise
+ * they are copied out of the receive buffer byte by byte as they arrive.
+ */
+#if UART1_RX_BUFFER_SIZE / UART_LINE_SLOTS > 82
+#define GPS_LINE_MODE
+#else
 char nmea_sentence[128];
 char *nmea_sentence_p = nmea_sentence;
+unsigned int nmea_sentence_error = 0;
+#endif
 
 typedef struct _gps_state_t
 {
@@ -60,90 +96,68 @@ typedef struct _gps_state_t
 
 gps_state_t gps_state;
 
-#define I2C_WAIT_CLEAR(v, b)  while(!((v) & _BV((b))))
-#define I2C_WAIT_SET(v, b)    while((v) & _BV((b)))
-
-uint8_t handle_i2c_slave_tx(uint8_t status, i2c_mode_t last_mode, i2c_mode_t current_mode)
+/*
+ * Fill the back buffer of the I2C registers from the GPS state, and publish
+ * it for the master to read.  If the last snapshot published is still
+ * waiting for a read in progress to finish, do nothing until next time.
+ */
+void publish_gps_data(void)
 {
-  if(status == TW_ST_SLA_ACK)
-  {
-    data.current_dt.year   = gps_state.gprmc.date.year;
-    data.current_dt.month  = gps_state.gprmc.date.month;
-    data.current_dt.date   = gps_state.gprmc.date.day;
-    data.current_dt.hour   = gps_state.gprmc.time.hour;
-    data.current_dt.minute = gps_state.gprmc.time.minute;
-    data.current_dt.second = gps_state.gprmc.time.second;
-    data.current_dt.millisecond =
-        current_time_ms < 1000 ? current_time_ms : 0;
-    data.current_dt.day_of_week = rtc_find_dow(
-        gps_state.gprmc.date.year,
-        gps_state.gprmc.date.month,
-        gps_state.gprmc.date.day);
-    data.gps_signal_strength = gps_state.gpgga.satellites_tracked <= 9 ?
-        gps_state.gpgga.satellites_tracked : 9;
-    data_p = (uint8_t *)&data;
-  }
-
-  if(status == TW_ST_SLA_ACK || status == TW_ST_DATA_ACK || status == TW_ST_DATA_NACK)
-    TWDR = *data_p++;
-
-  TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWEA);
+  gps_data_t *data;
+  uint16_t ms;
 
-  return 0;
-}
-
-uint8_t handle_i2c_slave_rx(uint8_t status, i2c_mode_t last_mode, i2c_mode_t current_mode)
-{
-  uint8_t i2c_register;
+  data = i2c_registers_back(&gps_registers);
+  if(!data)
+    return;
 
-  if(last_mode != current_mode)
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
   {
-    data_p = (uint8_t *)&data;
+    ms = current_time_ms;
   }
 
-  if(status == TW_SR_DATA_ACK || status == TW_SR_DATA_NACK)
-    i2c_register = TWDR;
-
-  return 0;
-}
-
-void print_date(nmea_date_t *date)
-{
-  printf("%04d-%02d-%02d",
-    date->year,
-    date->month,
-    date->day
-  );
-}
-
-void print_time(nmea_time_t *time)
-{
-  printf("%02d:%02d:%02d.%03d",
-    time->hour,
-    time->minute,
-    time->second,
-    time->millisecond
-  );
+  data->current_dt.year   = gps_state.gprmc.date.year;
+  data->current_dt.month  = gps_state.gprmc.date.month;
+  data->current_dt.date   = gps_state.gprmc.date.day;
+  data->current_dt.hour   = gps_state.gprmc.time.hour;
+  data->current_dt.minute = gps_state.gprmc.time.minute;
+  data->current_dt.second = gps_state.gprmc.time.second;
+  data->current_dt.millisecond = ms < 1000 ? ms : 0;
+  data->current_dt.day_of_week = rtc_find_dow(
+      gps_state.gprmc.date.year,
+      gps_state.gprmc.date.month,
+      gps_state.gprmc.date.day);
+  data->gps_signal_strength = gps_state.gpgga.satellites_tracked <= 9 ?
+      gps_state.gpgga.satellites_tracked : 9;
+
+  i2c_registers_publish(&gps_registers);
 }
 
+/*
+ * The GPS state is logged with UART_LOG() rather than printed, so that
+ * formatting the floats and waiting on the console doesn't hold up parsing
+ * the NMEA sentences; it is sent by uart_log_flush() in the main loop.
+ */
 void print_nmea_gprmc(nmea_gprmc_t *gprmc)
 {
-  printf("NMEA RMC:\n");
-  printf("  Status: %c\n", gprmc->status);
-  printf("  Mode: %c\n", gprmc->mode);
-  printf("  Time: ");
-  print_date(&gprmc->date);
-  printf(" ");
-  print_time(&gprmc->time);
-  printf("\n");
-  printf("  Position: %f, %f\n",
+  UART_LOG("NMEA RMC:\n");
+  UART_LOG("  Status: %c\n", gprmc->status);
+  UART_LOG("  Mode: %c\n", gprmc->mode);
+  UART_LOG("  Time: %04d-%02d-%02d %02d:%02d:%02d.%03d\n",
+      gprmc->date.year,
+      gprmc->date.month,
+      gprmc->date.day,
+      gprmc->time.hour,
+      gprmc->time.minute,
+      gprmc->time.second,
+      gprmc->time.millisecond);
+  UART_LOG("  Position: %f, %f\n",
       gprmc->position.latitude,
       gprmc->position.longitude);
-  printf("  Velocity: %f, %f\n",
+  UART_LOG("  Velocity: %f, %f\n",
       gprmc->velocity.speed,
       gprmc->velocity.heading);
-  printf("  Checksum: %02x\n", gprmc->checksum);
-  printf("\n");
+  UART_LOG("  Checksum: %02x\n", gprmc->checksum);
+  UART_LOG("\n");
 }
 
 // $GPRMC,070812.000,A,3923.1196,N,11937.6931,W,0.09,283.05,231115,,,A*74
@@ -155,7 +169,7 @@ void handle_nmea_gprmc(char *sentence)
   invalidity = nmea_parse_gprmc(sentence, &gprmc);
   if(invalidity != 0)
   {
-    printf("NMEA RMC Invalid: %04x; Checksum: %02x\n", invalidity, gprmc.checksum);
+    UART_LOG("NMEA RMC Invalid: %04x; Checksum: %02x\n", invalidity, gprmc.checksum);
   }
 
   gps_state.gprmc = gprmc;
@@ -170,20 +184,22 @@ void handle_nmea_gprmc(char *sentence)
 
 void print_nmea_gpgga(nmea_gpgga_t *gpgga)
 {
-  printf("NMEA GGA:\n");
-  printf("  Time: ");
-  print_time(&gpgga->time);
-  printf("\n");
-  printf("  Position: %f, %f\n",
+  UART_LOG("NMEA GGA:\n");
+  UART_LOG("  Time: %02d:%02d:%02d.%03d\n",
+      gpgga->time.hour,
+      gpgga->time.minute,
+      gpgga->time.second,
+      gpgga->time.millisecond);
+  UART_LOG("  Position: %f, %f\n",
       gpgga->position.latitude,
       gpgga->position.longitude);
-  printf("  Fix Quality: %d\n", gpgga->fix_quality);
-  printf("  Satellites Tracked: %d\n", gpgga->satellites_tracked);
-  printf("  HDOP: %f\n", gpgga->hdop);
-  printf("  Altitude: %f\n", gpgga->altitude);
-  printf("  Geoid Distance: %f\n", gpgga->geoid_height);
-  printf("  Checksum: %02x\n", gpgga->checksum);
-  printf("\n");
+  UART_LOG("  Fix Quality: %d\n", gpgga->fix_quality);
+  UART_LOG("  Satellites Tracked: %d\n", gpgga->satellites_tracked);
+  UART_LOG("  HDOP: %f\n", gpgga->hdop);
+  UART_LOG("  Altitude: %f\n", gpgga->altitude);
+  UART_LOG("  Geoid Distance: %f\n", gpgga->geoid_height);
+  UART_LOG("  Checksum: %02x\n", gpgga->checksum);
+  UART_LOG("\n");
 }
 
 // $GPGGA,070812.000,3923.1196,N,11937.6931,W,1,10,0.81,1773.2,M,-21.2,M,,*62
@@ -195,7 +211,7 @@ void handle_nmea_gpgga(char *sentence)
   invalidity = nmea_parse_gpgga(sentence, &gpgga);
   if(invalidity != 0)
   {
-    printf("NMEA GGA Invalid: %04x; Checksum: %02x\n", invalidity, gpgga.checksum);
+    UART_LOG("NMEA GGA Invalid: %04x; Checksum: %02x\n", invalidity, gpgga.checksum);
   }
 
   gps_state.gpgga = gpgga;
@@ -207,18 +223,20 @@ void handle_nmea_gpgga(char *sentence)
 
 void print_nmea_gpgsa(nmea_gpgsa_t *gpgsa)
 {
-  printf("NMEA GSA:\n");
-  printf("  Mode: %c\n", gpgsa->mode);
-  printf("  Fix Type: %c\n", gpgsa->fix_type);
-  printf("  Satellite PRNs:");
-  for(int index=0; index<12; index++)
-    printf(" %d", gpgsa->satellite_prn[index]);
-  printf("\n");
-  printf("  PDOP: %f\n", gpgsa->pdop);
-  printf("  HDOP: %f\n", gpgsa->hdop);
-  printf("  VDOP: %f\n", gpgsa->vdop);
-  printf("  Checksum: %02x\n", gpgsa->checksum);
-  printf("\n");
+  uint8_t *prn = gpgsa->satellite_prn;
+
+  UART_LOG("NMEA GSA:\n");
+  UART_LOG("  Mode: %c\n", gpgsa->mode);
+  UART_LOG("  Fix Type: %c\n", gpgsa->fix_type);
+  UART_LOG("  Satellite PRNs: %d %d %d %d %d %d",
+      prn[0], prn[1], prn[2], prn[3], prn[4], prn[5]);
+  UART_LOG(" %d %d %d %d %d %d\n",
+      prn[6], prn[7], prn[8], prn[9], prn[10], prn[11]);
+  UART_LOG("  PDOP: %f\n", gpgsa->pdop);
+  UART_LOG("  HDOP: %f\n", gpgsa->hdop);
+  UART_LOG("  VDOP: %f\n", gpgsa->vdop);
+  UART_LOG("  Checksum: %02x\n", gpgsa->checksum);
+  UART_LOG("\n");
 }
 
 // $GPGSA,A,3,28,09,08,13,19,30,07,27,11,05,,,1.13,0.81,0.79*03
@@ -230,7 +248,7 @@ void handle_nmea_gpgsa(char *sentence)
   invalidity = nmea_parse_gpgsa(sentence, &gpgsa);
   if(invalidity != 0)
   {
-    printf("NMEA GSA Invalid: %04x; Checksum: %02x\n", invalidity, gpgsa.checksum);
+    UART_LOG("NMEA GSA Invalid: %04x; Checksum: %02x\n", invalidity, gpgsa.checksum);
   }
 
   gps_state.gpgsa = gpgsa;
@@ -242,14 +260,14 @@ void handle_nmea_gpgsa(char *sentence)
 
 void print_nmea_gpgsv(nmea_gpgsv_t *gpgsv)
 {
-  printf("NMEA GSV:\n");
-  printf("  Sentence: %d of %d\n", gpgsv->sentence_number, gpgsv->sentence_total);
-  printf("  Satellites in view (of %d):\n", gpgsv->satellites_in_view);
+  UART_LOG("NMEA GSV:\n");
+  UART_LOG("  Sentence: %d of %d\n", gpgsv->sentence_number, gpgsv->sentence_total);
+  UART_LOG("  Satellites in view (of %d):\n", gpgsv->satellites_in_view);
   for(int i=0; i<4; i++)
   {
     if(gpgsv->satellite[i].prn)
     {
-      printf("    %2d: PRN: %2d, Alt: %2d, Az: %3d, SNR: %2d\n",
+      UART_LOG("    %2d: PRN: %2d, Alt: %2d, Az: %3d, SNR: %2d\n",
         gpgsv->satellite[i].index,
         gpgsv->satellite[i].prn,
         gpgsv->satellite[i].altitude,
@@ -257,13 +275,13 @@ void print_nmea_gpgsv(nmea_gpgsv_t *gpgsv)
         gpgsv->satellite[i].snr);
     }
   }
-  printf("  Checksum: %02x\n", gpgsv->checksum);
-  printf("\n");
+  UART_LOG("  Checksum: %02x\n", gpgsv->checksum);
+  UART_LOG("\n");
 }
 
 void print_nmea_gpgsv_summary(nmea_gpgsv_t *gpgsv)
 {
-  printf("Satellites in view (%d):\n", gpgsv[0].satellites_in_view);
+  UART_LOG("Satellites in view (%d):\n", gpgsv[0].satellites_in_view);
   for(int s=0; s<gpgsv[0].sentence_total; s++)
   {
     if(gpgsv[s].satellites_in_view > 0)
@@ -273,7 +291,7 @@ void print_nmea_gpgsv_summary(nmea_gpgsv_t *gpgsv)
         nmea_gpgsv_satellite_t *satellite = &gpgsv[s].satellite[i];
         if(satellite->prn)
         {
-          printf("  %2d: PRN: %2d, Alt: %2d, Az: %3d, SNR: %2d\n",
+          UART_LOG("  %2d: PRN: %2d, Alt: %2d, Az: %3d, SNR: %2d\n",
             satellite->index,
             satellite->prn,
             satellite->altitude,
@@ -283,7 +301,7 @@ void print_nmea_gpgsv_summary(nmea_gpgsv_t *gpgsv)
       }
     }
   }
-  printf("\n");
+  UART_LOG("\n");
 }
 
 // $GPGSV,4,1,13,07,66,049,21,30,62,322,20,28,48,239,23,09,41,161,22*74
@@ -295,7 +313,7 @@ void handle_nmea_gpgsv(char *sentence)
   invalidity = nmea_parse_gpgsv(sentence, &gpgsv);
   if(invalidity != 0)
   {
-    printf("NMEA GSV Invalid: %04x; Checksum: %02x\n", invalidity, gpgsv.checksum);
+    UART_LOG("NMEA GSV Invalid: %04x; Checksum: %02x\n", invalidity, gpgsv.checksum);
   }
 
   gps_state.gpgsv[gpgsv.sentence_number - 1] = gpgsv;
@@ -305,7 +323,7 @@ void handle_nmea_gpgsv(char *sentence)
 #endif // NMEA_DEBUG_GSV
 }
 
-void handle_nmea_sentence(void)
+void handle_nmea_sentence(char *nmea_sentence)
 {
 #ifdef NMEA_DEBUG_SENTENCES
   printf("NMEA: %s", nmea_sentence);
@@ -314,7 +332,7 @@ void handle_nmea_sentence(void)
   if(strncmp_P(nmea_sentence, PSTR("$GPRMC,"), 7) == 0)
   {
     handle_nmea_gprmc(nmea_sentence);
-    printf("Time at reset was ms = %d\n", last_time_ms);
+    UART_LOG("Time at reset was ms = %d\n", last_time_ms);
     //current_time_ms = 0;
   }
   else if(strncmp_P(nmea_sentence, PSTR("$GPGGA,"), 7) == 0)
@@ -336,35 +354,107 @@ void handle_gps_uart_input(uart_t *uart)
   gps_uart_data_ready = 1;
 }
 
+/*
+ * Log the UART errors received with a sentence, as from uart_getc().
+ */
+void log_gps_uart_errors(unsigned int error)
+{
+  if(error & UART_BUFFER_OVERFLOW)
+    UART_LOG("UART_BUFFER_OVERFLOW\n");
+  if(error & UART_OVERRUN_ERROR)
+    UART_LOG("UART_OVERRUN_ERROR\n");
+  if(error & UART_FRAME_ERROR)
+    UART_LOG("UART_FRAME_ERROR\n");
+}
+
+#ifdef GPS_LINE_MODE
 void handle_gps_uart_parsing(uart_t *uart)
 {
-  unsigned int data;
-  if(uart_data_ready(uart))
+  char *sentence;
+  uint16_t length;
+#if UART_RX_TIMESTAMPS
+  uint16_t pps;
+#endif
+
+  while((sentence = uart_line_get(uart, &length)))
   {
-    if(nmea_sentence_p >= nmea_sentence+127)
+    /* Drop the '\r' of a "\r\n" line ending */
+    if(length >= 2 && sentence[length-2] == '\r')
     {
-      uart_puts(u0, "Resetting nmea_sentence due to overflow\r\n");
-      *nmea_sentence = 0;
-      nmea_sentence_p = nmea_sentence;
+      sentence[length-2] = '\n';
+      sentence[length-1] = 0;
     }
-    while(((data = uart_getc(uart)) & 0xff00) == 0)
+    log_gps_uart_errors(uart_line_error(uart));
+#if UART_RX_TIMESTAMPS
+    if(strncmp_P(sentence, PSTR("$GPRMC,"), 7) == 0)
     {
-      if(data == '\r') continue;
-      *nmea_sentence_p++ = data;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      {
+        pps = pps_timestamp;
+      }
+      UART_LOG("GPRMC started %u ms after PPS\n",
+          GPS_TICKS_TO_MS(uart_line_timestamp(uart) - pps));
+    }
+#endif
+    handle_nmea_sentence(sentence);
+    uart_line_release(uart);
+  }
+}
+#else
+void handle_gps_uart_parsing(uart_t *uart)
+{
+  uint16_t length;
+
+  if(!uart_data_ready(uart))
+    return;
+
+  if(nmea_sentence_p >= nmea_sentence+127)
+  {
+    UART_LOG("Resetting nmea_sentence due to overflow\n");
+    nmea_sentence_p = nmea_sentence;
+    nmea_sentence_error = 0;
+  }
 
-      if(data == '\n')
+  while((length = uart_read_until(uart, (unsigned char *)nmea_sentence_p,
+      nmea_sentence + 127 - nmea_sentence_p, '\n')) > 0)
+  {
+    nmea_sentence_p += length;
+    nmea_sentence_error |= uart_read_error(uart);
+
+    if(nmea_sentence_p[-1] == '\n')
+    {
+      /* Drop the '\r' of a "\r\n" line ending */
+      if(nmea_sentence_p - nmea_sentence >= 2 && nmea_sentence_p[-2] == '\r')
       {
-        *nmea_sentence_p++ = 0;
-        handle_nmea_sentence();
-        *nmea_sentence = 0;
-        nmea_sentence_p = nmea_sentence;
+        nmea_sentence_p[-2] = '\n';
+        nmea_sentence_p--;
       }
+      *nmea_sentence_p = 0;
+      log_gps_uart_errors(nmea_sentence_error);
+      handle_nmea_sentence(nmea_sentence);
+      nmea_sentence_p = nmea_sentence;
+      nmea_sentence_error = 0;
     }
-    //if(data & UART_BUFFER_OVERFLOW) uart_puts(u0, "UART_BUFFER_OVERFLOW\r\n");
-    //if(data & UART_OVERRUN_ERROR) uart_puts(u0, "UART_OVERRUN_ERROR\r\n");
-    //if(data & UART_FRAME_ERROR) uart_puts(u0, "UART_FRAME_ERROR\r\n");
   }
 }
+#endif
+
+void print_gps_uart_errors(uart_t *uart)
+{
+  uart_error_counters_t errors;
+
+  uart_get_error_counters(uart, &errors);
+
+  UART_LOG("GPS UART Errors:\n");
+  UART_LOG("  Frame: %u\n", errors.frame);
+  UART_LOG("  Overrun: %u\n", errors.overrun);
+  UART_LOG("  Buffer Overflow: %u\n", errors.overflow);
+  UART_LOG("  Log Frames Dropped: %u\n", uart_log.dropped_total);
+#ifdef GPS_PASSTHROUGH
+  UART_LOG("  Passthrough Lines Dropped: %u\n", uart->bridge.dropped);
+#endif
+  UART_LOG("\n");
+}
 
 void print_gps_state(void)
 {
@@ -372,6 +462,7 @@ void print_gps_state(void)
   print_nmea_gpgga(&gps_state.gpgga);
   print_nmea_gpgsa(&gps_state.gpgsa);
   print_nmea_gpgsv_summary(gps_state.gpgsv);
+  print_gps_uart_errors(u1);
 }
 
 ISR(TIMER0_COMPA_vect)
@@ -384,6 +475,9 @@ ISR(PCINT3_vect)
 {
   if(PIND & _BV(PD4))
   {
+#if UART_RX_TIMESTAMPS
+    pps_timestamp = TCNT1;
+#endif
     last_time_ms = current_time_ms;
     current_time_ms = 0;
   }
@@ -414,20 +508,35 @@ int main(void)
 
   memset(&gps_state, 0, sizeof(gps_state));
 
-  u0 = uart_init("0", UART_BAUD_SELECT(38400, F_CPU));
+  u0 = uart_init("0", 38400);
   uart_init_stdout(u0);
+  uart_log_init(log_buffer, sizeof(log_buffer));
 
-  u1 = uart_init("1", UART_BAUD_SELECT(9600, F_CPU));
+  u1 = uart_init("1", 9600);
   uart_set_rx_callback(u1, handle_gps_uart_input);
 
+#ifdef GPS_LINE_MODE
+  uart_set_line_mode(u1, '\n');
+#endif
+
+#ifdef GPS_PASSTHROUGH
+  uart_set_bridge(u1, u0, UART_BRIDGE_TEE);
+#endif
+
   i2c_init();
   i2c_slave_init(0x60, I2C_ADDRESS_MASK_SINGLE, I2C_GCALL_DISABLED);
-  i2c_global.sr_callback = handle_i2c_slave_rx;
-  i2c_global.st_callback = handle_i2c_slave_tx;
+  i2c_slave_registers(&gps_registers,
+      &gps_data[0], &gps_data[1], sizeof(gps_data_t));
 
   current_time_ms = 0;
   init_timer_hz(1000 + 24);
 
+#if UART_RX_TIMESTAMPS
+  /* Timer1 free-running at F_CPU/1024 for UART timestamps */
+  TCCR1A = 0;
+  TCCR1B = _BV(CS12) | _BV(CS10);
+#endif
+
   PIND |= _BV(PD4);
   PORTD &= ~_BV(PD4);
   PCMSK3 |= _BV(PCINT28);
@@ -441,7 +550,13 @@ int main(void)
 
   while(1)
   {
+#ifdef GPS_PASSTHROUGH
+    /* Forward the sentences before they are parsed and released */
+    uart_bridge_pump(u1);
+#endif
     handle_gps_uart_parsing(u1);
+    publish_gps_data();
+    uart_log_flush(u0);
 
     if(gps_state.gprmc.time.second % 10 == 0)
     {
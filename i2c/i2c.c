@@ -19,25 +19,613 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
 #include <avr/interrupt.h>
 #include <inttypes.h>
+#include <util/atomic.h>
+#include <util/delay.h>
 #include <util/twi.h>
 
 #include "i2c.h"
 
-/* I2C clock in Hz */
+/* I2C clock in Hz, for i2c_start() without a device */
 #ifndef I2C_SCL_CLOCK
 #define I2C_SCL_CLOCK  100000L
 #endif
 
-#define I2C_WAIT_CLEAR(v, b)  while(!((v) & _BV((b))))
-#define I2C_WAIT_SET(v, b)    while((v) & _BV((b)))
+/*
+ * Longest time to wait on the bus for any one step (START, address, byte or
+ * STOP) of a blocking transfer, or for a queued transaction to make progress,
+ * before giving up with I2C_ERROR_TIMEOUT and recovering the bus.
+ */
+#ifndef I2C_TIMEOUT_US
+#define I2C_TIMEOUT_US 10000L
+#endif
+
+/*
+ * Approximate CPU cycles per iteration of a wait loop, and the iterations in
+ * a time, worked out in kHz so that clocks below 1 MHz still count.
+ */
+#define I2C_WAIT_LOOP_CYCLES  10
+#define I2C_US_TO_LOOPS(us) \
+  ((uint32_t)(us) * (F_CPU / 1000) / (1000UL * I2C_WAIT_LOOP_CYCLES))
+#define I2C_TIMEOUT_LOOPS     I2C_US_TO_LOOPS(I2C_TIMEOUT_US)
+
+#define I2C_WAIT_CLEAR(v, b)  i2c_wait(&(v), _BV((b)), _BV((b)))
+#define I2C_WAIT_SET(v, b)    i2c_wait(&(v), _BV((b)), 0)
+
+/*
+ * The TWI pins, driven directly by i2c_recover() to free a stuck bus.
+ */
+#ifndef I2C_PORT
+#if defined(__AVR_ATmega164P__) \
+  || defined(__AVR_ATmega324P__) \
+  || defined(__AVR_ATmega644__) \
+  || defined(__AVR_ATmega644P__) \
+  || defined(__AVR_ATmega1284P__)
+#define I2C_PORT  PORTC
+#define I2C_DDR   DDRC
+#define I2C_PIN   PINC
+#define I2C_SCL   _BV(PC0)
+#define I2C_SDA   _BV(PC1)
+#elif defined(__AVR_ATmega8__) \
+  || defined(__AVR_ATmega48__) \
+  || defined(__AVR_ATmega88__) \
+  || defined(__AVR_ATmega168__) \
+  || defined(__AVR_ATmega328P__)
+#define I2C_PORT  PORTC
+#define I2C_DDR   DDRC
+#define I2C_PIN   PINC
+#define I2C_SCL   _BV(PC5)
+#define I2C_SDA   _BV(PC4)
+#elif defined(__AVR_ATmega1280__) \
+  || defined(__AVR_ATmega2560__)
+#define I2C_PORT  PORTD
+#define I2C_DDR   DDRD
+#define I2C_PIN   PIND
+#define I2C_SCL   _BV(PD0)
+#define I2C_SDA   _BV(PD1)
+#else
+#error "TWI pins unknown for this MCU; define I2C_PORT, I2C_DDR, I2C_PIN, I2C_SCL and I2C_SDA"
+#endif
+#endif
+
+/* Half of one SCL period at 100kHz, for clocking the bus by hand */
+#define I2C_RECOVER_DELAY_US  5
 
 #define I2C_ENABLE_ISR()      TWCR |= _BV(TWIE)
 #define I2C_DISABLE_ISR()     TWCR &= ~_BV(TWIE)
 
+/* TWCR for the next step of a master transaction */
+#define I2C_MASTER(flags)     (_BV(TWINT) | _BV(TWEN) | _BV(TWIE) | (flags))
+
+/*
+ * Let the TWI interrupt be taken while waiting on the queue.  The host build
+ * (see i2c_host/) has no interrupts, so it runs the simulated TWI instead.
+ */
+#if defined(I2C_HOST)
+extern void i2c_host_run(void);
+#define I2C_POLL() i2c_host_run()
+#else
+#define I2C_POLL()
+#endif
+
 volatile i2c_t i2c_global;
 
+/* Time spent waiting during the current blocking transaction, in loops */
+static uint32_t i2c_wait_loops;
+
+#if I2C_TRACE
+i2c_trace_t i2c_trace;
+
+/*
+ * Find the counters for address (in either direction), adding them if
+ * there's room.
+ */
+static i2c_address_statistics_t *i2c_trace_statistics(uint8_t address)
+{
+  uint8_t i;
+
+  address &= ~I2C_READ;
+
+  for(i = 0; i < i2c_trace.address_count; i++)
+    if(i2c_trace.addresses[i].address == address)
+      return &i2c_trace.addresses[i];
+
+  if(i2c_trace.address_count == I2C_TRACE_ADDRESSES)
+    return NULL;
+
+  i2c_trace.addresses[i].address = address;
+  i2c_trace.address_count++;
+  return &i2c_trace.addresses[i];
+}
+
+/*
+ * Record status (a TW_STATUS or I2C_TRACE_* event) in the trace ring,
+ * noting any failure or lost arbitration against the current transaction.
+ */
+static void i2c_trace_record(uint8_t status)
+{
+  i2c_address_statistics_t *statistics;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    switch(status)
+    {
+    case TW_MT_SLA_NACK:
+    case TW_MT_DATA_NACK:
+    case TW_MR_SLA_NACK:
+    case I2C_TRACE_TIMEOUT:
+      if(i2c_trace.active && !i2c_trace.result)
+        i2c_trace.result = status;
+      break;
+
+    case TW_MT_ARB_LOST:
+    case TW_SR_ARB_LOST_SLA_ACK:
+    case TW_SR_ARB_LOST_GCALL_ACK:
+    case TW_ST_ARB_LOST_SLA_ACK:
+      if(i2c_trace.active
+          && (statistics = i2c_trace_statistics(i2c_trace.address)))
+        statistics->arbitration_lost++;
+      break;
+    }
+
+    if(!i2c_trace.paused)
+    {
+      i2c_trace.entry[i2c_trace.head].time = I2C_TRACE_COUNTER;
+      i2c_trace.entry[i2c_trace.head].status = status;
+      i2c_trace.entry[i2c_trace.head].address = i2c_trace.address;
+      i2c_trace.head = (i2c_trace.head + 1) & (I2C_TRACE_SIZE - 1);
+      if(i2c_trace.count < I2C_TRACE_SIZE)
+        i2c_trace.count++;
+      else if(i2c_trace.dropped < 0xffff)
+        i2c_trace.dropped++;
+    }
+  }
+}
+
+/*
+ * Start timing a master transaction with address (and direction).
+ */
+static void i2c_trace_begin(uint8_t address)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    i2c_trace.address = address;
+    i2c_trace.result = 0;
+    i2c_trace.active = 1;
+    i2c_trace.start = I2C_TRACE_COUNTER;
+  }
+  i2c_trace_record(I2C_TRACE_START);
+}
+
+/*
+ * Count the master transaction in progress, with its duration and result.
+ */
+static void i2c_trace_end(void)
+{
+  i2c_address_statistics_t *statistics;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if(i2c_trace.active
+        && (statistics = i2c_trace_statistics(i2c_trace.address)))
+    {
+      statistics->transactions++;
+      statistics->total_time += (uint16_t)(I2C_TRACE_COUNTER - i2c_trace.start);
+      if(i2c_trace.result == I2C_TRACE_TIMEOUT)
+        statistics->timeouts++;
+      else if(i2c_trace.result)
+        statistics->naks++;
+    }
+    i2c_trace.active = 0;
+  }
+  i2c_trace_record(I2C_TRACE_STOP);
+}
+
+#define I2C_TRACE_RECORD(status)  i2c_trace_record(status)
+#define I2C_TRACE_BEGIN(address)  i2c_trace_begin(address)
+#define I2C_TRACE_END()           i2c_trace_end()
+#else
+#define I2C_TRACE_RECORD(status)
+#define I2C_TRACE_BEGIN(address)
+#define I2C_TRACE_END()
+#endif
+
+/*
+ * Record the time spent waiting in one transaction, if the longest yet.
+ */
+static void i2c_note_wait(uint32_t loops)
+{
+  uint32_t us;
+
+  /* Clamped first, so that the conversion can't overflow */
+  if(loops >= I2C_US_TO_LOOPS(0xffff))
+    us = 0xffff;
+  else
+    us = loops * (1000UL * I2C_WAIT_LOOP_CYCLES) / (F_CPU / 1000);
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if(us > i2c_global.statistics.max_wait_us)
+      i2c_global.statistics.max_wait_us = us;
+  }
+}
+
+/*
+ * Count a timeout and free the bus.
+ */
+static void i2c_timeout(void)
+{
+  I2C_TRACE_RECORD(I2C_TRACE_TIMEOUT);
+  i2c_global.statistics.timeouts++;
+  i2c_recover();
+}
+
+/*
+ * Wait for (*reg & mask) == value, giving up and recovering the bus after
+ * I2C_TIMEOUT_US.
+ *
+ * Return:  0 condition met
+ *          I2C_ERROR_TIMEOUT
+ */
+static uint8_t i2c_wait(volatile uint8_t *reg, uint8_t mask, uint8_t value)
+{
+  uint32_t loops = 0;
+
+  while((*reg & mask) != value)
+  {
+    if(++loops >= I2C_TIMEOUT_LOOPS)
+    {
+      i2c_timeout();
+      return I2C_ERROR_TIMEOUT;
+    }
+  }
+
+  i2c_wait_loops += loops;
+  return 0;
+}
+
+/*
+ * Wait for a queued transaction to complete, or for the queue to empty if
+ * transaction is NULL.  As many transactions may be queued ahead, only a
+ * lack of progress (no TWI interrupt) for I2C_TIMEOUT_US is a timeout, after
+ * which the bus is recovered, failing the transaction in progress (or held
+ * back).
+ */
+static void i2c_wait_queue(i2c_transaction_t *transaction)
+{
+  uint32_t loops = 0;
+  uint32_t total = 0;
+  uint8_t steps = i2c_global.steps;
+
+  while(transaction ? (transaction->status == I2C_PENDING)
+                    : (i2c_global.transaction != NULL))
+  {
+    I2C_POLL();
+    total++;
+    if(steps != i2c_global.steps)
+    {
+      steps = i2c_global.steps;
+      loops = 0;
+    }
+    else if(++loops >= I2C_TIMEOUT_LOOPS)
+    {
+      /*
+       * No blocking transfer is in progress while waiting here, so if one
+       * still holds the bus, its caller never called i2c_stop().  Drop the
+       * stale claim, so that the recovery fails the transaction held back.
+       */
+      i2c_global.blocking = 0;
+      i2c_timeout();
+      loops = 0;
+    }
+  }
+
+  if(transaction)
+    i2c_note_wait(total);
+}
+
+/*
+ * Set the bit rate for device.  Only change it while the bus is idle, or
+ * while the TWI is waiting for its next command (TWINT set).
+ */
+static void i2c_set_speed(const i2c_device_t *device)
+{
+  TWBR = device->twbr;
+  TWSR = device->twps;
+}
+
+/*
+ * Return true if device runs at a slower clock than the current bit rate.
+ */
+static uint8_t i2c_is_slower(const i2c_device_t *device)
+{
+  return ((uint32_t)device->twbr << (2 * device->twps))
+    > ((uint32_t)TWBR << (2 * (TWSR & 0x03)));
+}
+
+/*
+ * Prepare to run the transaction at the head of the queue from its start.
+ * Its speed is set once its START is done.
+ */
+static void i2c_begin(void)
+{
+  i2c_transaction_t *transaction = i2c_global.transaction;
+
+  I2C_TRACE_BEGIN(transaction->device->address
+      | ((transaction->write_length == 0) ? I2C_READ : I2C_WRITE));
+
+  i2c_global.position = 0;
+  i2c_global.reading = (transaction->write_length == 0
+      && transaction->read_length != 0);
+  i2c_global.mode = i2c_global.reading ? I2C_MODE_MR : I2C_MODE_MT;
+}
+
+/*
+ * Start the transaction at the head of the queue, if any, when the bus is
+ * idle.  Called with interrupts disabled.
+ */
+static void i2c_next(void)
+{
+  if(!i2c_global.transaction || i2c_global.mode != I2C_MODE_IDLE)
+    return;
+
+  i2c_set_speed(i2c_global.transaction->device);
+  i2c_begin();
+  TWCR = I2C_MASTER(_BV(TWSTA));
+}
+
+/*
+ * Complete the transaction in progress with status, and release the bus,
+ * or keep it with a repeated START if another transaction is queued.
+ */
+static void i2c_master_complete(uint8_t status)
+{
+  i2c_transaction_t *transaction = i2c_global.transaction;
+
+  I2C_TRACE_END();
+
+  i2c_global.transaction = transaction->next;
+  if(!i2c_global.transaction)
+    i2c_global.last = NULL;
+
+  /* The callback may queue another transaction, which isn't started yet */
+  transaction->status = status;
+  if(transaction->callback)
+    (*transaction->callback)(transaction);
+
+  i2c_global.mode = I2C_MODE_IDLE;
+  i2c_global.statistics.transactions++;
+  if(status)
+    i2c_global.statistics.failures++;
+
+  if(status == I2C_ERROR_BUS || status == I2C_ERROR_TIMEOUT)
+  {
+    /* The hardware has already released the bus, or it was recovered */
+    i2c_next();
+    return;
+  }
+
+  if(i2c_global.transaction)
+  {
+    /*
+     * STOP followed immediately by START for the next transaction, without
+     * waiting here for the STOP.  Both are sent at the slower speed of the
+     * two devices, to suit both, until the START is done.
+     */
+    if(i2c_is_slower(i2c_global.transaction->device))
+      i2c_set_speed(i2c_global.transaction->device);
+    i2c_begin();
+    TWCR = I2C_MASTER(_BV(TWSTO) | _BV(TWSTA));
+    return;
+  }
+
+  TWCR = I2C_MASTER(_BV(TWSTO) | i2c_global.slave_ack);
+}
+
+/*
+ * Advance the transaction in progress by one step, after the TWI has set
+ * TWINT with status.
+ */
+static void i2c_master_step(uint8_t status)
+{
+  i2c_transaction_t *transaction = i2c_global.transaction;
+
+  switch(status)
+  {
+  case TW_START:
+  case TW_REP_START:
+    i2c_set_speed(transaction->device);
+    TWDR = transaction->device->address
+         | (i2c_global.reading ? I2C_READ : I2C_WRITE);
+    TWCR = I2C_MASTER(0);
+    break;
+
+  case TW_MT_SLA_ACK:
+  case TW_MT_DATA_ACK:
+    if(i2c_global.position < transaction->write_length)
+    {
+      TWDR = transaction->write_buffer[i2c_global.position++];
+      TWCR = I2C_MASTER(0);
+    }
+    else if(transaction->read_length)
+    {
+      /* Turn around to read with a repeated START, keeping the bus */
+#if I2C_TRACE
+      i2c_trace.address |= I2C_READ;
+#endif
+      i2c_global.position = 0;
+      i2c_global.reading = 1;
+      i2c_global.mode = I2C_MODE_MR;
+      TWCR = I2C_MASTER(_BV(TWSTA));
+    }
+    else
+    {
+      i2c_master_complete(0);
+    }
+    break;
+
+  case TW_MR_DATA_ACK:
+    transaction->read_buffer[i2c_global.position++] = TWDR;
+    /* FALLTHROUGH */
+  case TW_MR_SLA_ACK:
+    /* Acknowledge every byte but the last */
+    TWCR = I2C_MASTER(
+        (i2c_global.position + 1 < transaction->read_length) ? _BV(TWEA) : 0);
+    break;
+
+  case TW_MR_DATA_NACK:
+    transaction->read_buffer[i2c_global.position++] = TWDR;
+    i2c_master_complete(0);
+    break;
+
+  case TW_MT_ARB_LOST:
+    /* Another master won the bus, so start over once it is free */
+    i2c_begin();
+    TWCR = I2C_MASTER(_BV(TWSTA));
+    break;
+
+  default:
+    /* Address or data not acknowledged */
+    i2c_master_complete(status);
+    break;
+  }
+}
+
+/*
+ * Serve one step of a write to the register file: the first byte after our
+ * address selects the register, and any more are ignored.
+ */
+static void i2c_registers_receive(i2c_registers_t *registers, uint8_t status)
+{
+  uint8_t data;
+
+  switch(status)
+  {
+  case TW_SR_SLA_ACK:
+  case TW_SR_ARB_LOST_SLA_ACK:
+  case TW_SR_GCALL_ACK:
+  case TW_SR_ARB_LOST_GCALL_ACK:
+    registers->addressed = 1;
+    break;
+
+  case TW_SR_DATA_ACK:
+  case TW_SR_DATA_NACK:
+  case TW_SR_GCALL_DATA_ACK:
+  case TW_SR_GCALL_DATA_NACK:
+    data = TWDR;
+    if(registers->addressed)
+    {
+      registers->pointer = (data < registers->size) ? data : 0;
+      registers->addressed = 0;
+    }
+    break;
+  }
+
+  TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWEA);
+}
+
+/*
+ * Serve one step of a read from the register file, from the front buffer,
+ * auto-incrementing the register pointer and wrapping at the end.
+ */
+static void i2c_registers_transmit(i2c_registers_t *registers, uint8_t status)
+{
+  switch(status)
+  {
+  case TW_ST_SLA_ACK:
+  case TW_ST_ARB_LOST_SLA_ACK:
+  case TW_ST_DATA_ACK:
+    TWDR = registers->buffer[registers->front][registers->pointer];
+    if(++registers->pointer >= registers->size)
+      registers->pointer = 0;
+    break;
+
+  case TW_ST_DATA_NACK:
+  case TW_ST_LAST_DATA:
+    /* The read is over, so a buffer published during it can be served */
+    if(registers->pending)
+    {
+      registers->front ^= 1;
+      registers->pending = 0;
+    }
+    break;
+  }
+
+  TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWEA);
+}
+
+/*
+ * Receive one byte of a write from the master into the slave buffers.
+ */
+static void i2c_slave_receive(i2c_slave_buffers_t *buffers, uint8_t status)
+{
+  uint8_t data;
+
+  switch(status)
+  {
+  case TW_SR_SLA_ACK:
+  case TW_SR_ARB_LOST_SLA_ACK:
+  case TW_SR_GCALL_ACK:
+  case TW_SR_ARB_LOST_GCALL_ACK:
+    buffers->count = 0;
+    buffers->status = 0;
+    break;
+
+  case TW_SR_DATA_ACK:
+  case TW_SR_DATA_NACK:
+  case TW_SR_GCALL_DATA_ACK:
+  case TW_SR_GCALL_DATA_NACK:
+    data = TWDR;
+    if(buffers->count < buffers->rx_size)
+      buffers->rx_buffer[buffers->count++] = data;
+    else
+      buffers->status |= I2C_SLAVE_OVERFLOW;
+    break;
+  }
+
+  TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWEA);
+}
+
+/*
+ * Send one byte of a read by the master from the slave buffers, and call
+ * back once the master has ended the read.
+ */
+static void i2c_slave_transmit(i2c_slave_buffers_t *buffers, uint8_t status)
+{
+  switch(status)
+  {
+  case TW_ST_SLA_ACK:
+  case TW_ST_ARB_LOST_SLA_ACK:
+    buffers->count = 0;
+    buffers->status = 0;
+    /* FALLTHROUGH */
+  case TW_ST_DATA_ACK:
+    if(buffers->count < buffers->tx_length)
+    {
+      TWDR = buffers->tx_buffer[buffers->count];
+    }
+    else
+    {
+      TWDR = 0xff;
+      buffers->status |= I2C_SLAVE_OVERFLOW;
+    }
+    buffers->count++;
+    break;
+
+  case TW_ST_DATA_NACK:
+  case TW_ST_LAST_DATA:
+    if(buffers->count < buffers->tx_length)
+      buffers->status |= I2C_SLAVE_NAK;
+    if(buffers->callback)
+      (*buffers->callback)(I2C_MODE_ST, buffers->count, buffers->status);
+    break;
+  }
+
+  TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWEA);
+}
+
 ISR(TWI_vect)
 {
   uint8_t status;
@@ -45,6 +633,8 @@ ISR(TWI_vect)
 
   last_mode = i2c_global.mode;
   status = TW_STATUS;
+  i2c_global.steps++;
+  I2C_TRACE_RECORD(status);
 
   /*
    * Receiving any of these statuses changes the current I2C mode regardless
@@ -70,6 +660,12 @@ ISR(TWI_vect)
   case TW_BUS_ERROR:
     TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWEA);
     i2c_global.mode = I2C_MODE_IDLE;
+    if(i2c_global.transaction
+        && (last_mode == I2C_MODE_MT || last_mode == I2C_MODE_MR))
+    {
+      i2c_master_complete(I2C_ERROR_BUS);
+      return;
+    }
     break;
   }
 
@@ -77,17 +673,41 @@ ISR(TWI_vect)
   {
   case I2C_MODE_MT:
   case I2C_MODE_MR:
+    if(i2c_global.transaction)
+      i2c_master_step(status);
     break;
 
   case I2C_MODE_ST:
-    if(i2c_global.st_callback)
+    if(i2c_global.registers)
+    {
+      i2c_registers_transmit(i2c_global.registers, status);
+    }
+    else if(i2c_global.slave_buffers)
+    {
+      i2c_slave_transmit(i2c_global.slave_buffers, status);
+    }
+    else if(i2c_global.st_callback)
     {
       (*i2c_global.st_callback)(status, last_mode, i2c_global.mode);
       TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWEA);
     }
+    if(status == TW_ST_DATA_NACK || status == TW_ST_LAST_DATA)
+    {
+      /* The master has finished reading, with no STOP to be seen */
+      i2c_global.mode = I2C_MODE_IDLE;
+      i2c_next();
+    }
     break;
   case I2C_MODE_SR:
-    if(i2c_global.sr_callback)
+    if(i2c_global.registers)
+    {
+      i2c_registers_receive(i2c_global.registers, status);
+    }
+    else if(i2c_global.slave_buffers)
+    {
+      i2c_slave_receive(i2c_global.slave_buffers, status);
+    }
+    else if(i2c_global.sr_callback)
     {
       if(0 == (*i2c_global.sr_callback)(status, last_mode, i2c_global.mode))
         TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWEA);
@@ -97,11 +717,17 @@ ISR(TWI_vect)
   case I2C_MODE_IDLE:
     if(last_mode == I2C_MODE_SR)
     {
-      if(i2c_global.stop_callback)
+      if(i2c_global.slave_buffers && i2c_global.slave_buffers->callback)
+      {
+        (*i2c_global.slave_buffers->callback)(I2C_MODE_SR,
+            i2c_global.slave_buffers->count, i2c_global.slave_buffers->status);
+      }
+      else if(i2c_global.stop_callback)
       {
         (*i2c_global.stop_callback)(status, last_mode, i2c_global.mode);
       }
     }
+    i2c_next();
     break;
   case I2C_MODE_UNKNOWN:
   default:
@@ -114,10 +740,24 @@ ISR(TWI_vect)
  */
 void i2c_init(void)
 {
-  TWBR = ((F_CPU/I2C_SCL_CLOCK)-16)/2;
+  i2c_global.bus_default.address = 0;
+  i2c_global.bus_default.twbr = I2C_TWBR(I2C_SCL_CLOCK);
+  i2c_global.bus_default.twps = I2C_TWPS(I2C_SCL_CLOCK);
+  i2c_set_speed((i2c_device_t *)&i2c_global.bus_default);
+
   i2c_global.mode = I2C_MODE_IDLE;
   i2c_global.st_callback = NULL;
   i2c_global.sr_callback = NULL;
+  i2c_global.registers = NULL;
+  i2c_global.slave_buffers = NULL;
+  i2c_global.transaction = NULL;
+  i2c_global.last = NULL;
+  i2c_global.slave_ack = 0;
+  i2c_global.blocking = 0;
+  i2c_reset_statistics();
+#if I2C_TRACE
+  i2c_trace_reset();
+#endif
   I2C_ENABLE_ISR();
 }
 
@@ -127,29 +767,95 @@ uint8_t i2c_slave_init(uint8_t address, uint8_t address_mask, uint8_t gcall)
   TWAMR = address_mask;
   TWCR  = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWEA);
 
+  /* Keep acknowledging our address after acting as master */
+  i2c_global.slave_ack = _BV(TWEA);
+
   return TWAR;
 }
 
+void i2c_slave_registers(i2c_registers_t *registers,
+                         void *front, void *back, uint8_t size)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    registers->buffer[0] = front;
+    registers->buffer[1] = back;
+    registers->size = size;
+    registers->front = 0;
+    registers->pending = 0;
+    registers->pointer = 0;
+    registers->addressed = 0;
+    i2c_global.registers = registers;
+  }
+}
+
+void i2c_slave_buffers(i2c_slave_buffers_t *buffers,
+                       uint8_t *rx_buffer, uint8_t rx_size,
+                       uint8_t *tx_buffer, uint8_t tx_length,
+                       i2c_slave_callback_t *callback)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    buffers->rx_buffer = rx_buffer;
+    buffers->rx_size = rx_size;
+    buffers->tx_buffer = tx_buffer;
+    buffers->tx_length = tx_length;
+    buffers->callback = callback;
+    buffers->count = 0;
+    buffers->status = 0;
+    i2c_global.slave_buffers = buffers;
+  }
+}
+
 /*
- * Issues a start condition and sends address and transfer direction.
- *
- * Return: 0 device accessible
- *         1 failed to access device
+ * Return the back buffer of the register file, which isn't being served,
+ * or NULL if it was published during a read still in progress.
  */
-uint8_t i2c_start(uint8_t address, uint8_t mode)
+void *i2c_registers_back(i2c_registers_t *registers)
 {
-  uint8_t twst;
+  void *back = NULL;
 
-  i2c_global.mode = (mode == I2C_WRITE)?I2C_MODE_MT:I2C_MODE_MR;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if(!registers->pending)
+      back = registers->buffer[registers->front ^ 1];
+  }
+
+  return back;
+}
+
+/*
+ * Swap the back buffer to the front, once no read is in progress, so that
+ * the master always reads a consistent snapshot.
+ */
+void i2c_registers_publish(i2c_registers_t *registers)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if(i2c_global.mode == I2C_MODE_ST)
+      registers->pending = 1;
+    else
+      registers->front ^= 1;
+  }
+}
+
+/*
+ * Issues a start condition, or a repeated start condition if the bus is
+ * already held, and sends address and transfer direction.
+ */
+static uint8_t i2c_address(uint8_t address, uint8_t mode)
+{
+  uint8_t twst;
 
   /* Send START condition */
   TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTA);
 
   /* Wait until transmission completed */
-  I2C_WAIT_CLEAR(TWCR, TWINT);
+  if(I2C_WAIT_CLEAR(TWCR, TWINT)) return I2C_ERROR_TIMEOUT;
 
   /* Check value of TWI Status Register. */
   twst = TW_STATUS;
+  I2C_TRACE_RECORD(twst);
   if ( (twst != TW_START) && (twst != TW_REP_START)) return twst;
 
   /* Send device address */
@@ -157,43 +863,132 @@ uint8_t i2c_start(uint8_t address, uint8_t mode)
   TWCR = _BV(TWINT) | _BV(TWEN);
 
   /* Wait until transmission completed and ACK/NACK has been received */
-  I2C_WAIT_CLEAR(TWCR, TWINT);
+  if(I2C_WAIT_CLEAR(TWCR, TWINT)) return I2C_ERROR_TIMEOUT;
 
   /* Check value of TWI Status Register. */
   twst = TW_STATUS;
-  if ( (twst != TW_MT_SLA_ACK) && (twst != TW_MR_SLA_ACK) ) return twst;
+  I2C_TRACE_RECORD(twst);
+  if ( (twst != TW_MT_SLA_ACK) && (twst != TW_MR_SLA_ACK) )
+  {
+    i2c_global.statistics.failures++;
+    return twst;
+  }
 
   return 0;
 }
 
 
 /*
- * Issues a repeated start condition and sends address and transfer direction.
+ * Issues a start condition to device, at its speed, and sends address and
+ * transfer direction.  The bus is held, and queued transactions wait, until
+ * i2c_stop(), unless the start fails, when the bus is released here.
+ *
+ * Return: 0 device accessible
+ *         the TW_STATUS at which the transfer failed, or I2C_ERROR_TIMEOUT
+ */
+uint8_t i2c_device_start(const i2c_device_t *device, uint8_t mode)
+{
+  uint8_t busy = 1;
+  uint8_t rc;
+
+  /* Wait for queued transactions, and keep new ones from starting */
+  while(busy)
+  {
+    i2c_wait_queue(NULL);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      busy = (i2c_global.transaction != NULL);
+      if(!busy)
+      {
+        i2c_global.mode = (mode == I2C_WRITE)?I2C_MODE_MT:I2C_MODE_MR;
+        i2c_global.blocking = 1;
+        i2c_global.statistics.transactions++;
+      }
+    }
+  }
+
+  i2c_wait_loops = 0;
+  i2c_set_speed(device);
+  I2C_TRACE_BEGIN(device->address | mode);
+
+  rc = i2c_address(device->address, mode);
+  if(rc)
+    i2c_stop();
+
+  return rc;
+}
+
+
+/*
+ * Issues a start condition at the default speed (I2C_SCL_CLOCK) and sends
+ * address and transfer direction.
+ *
+ * Return: 0 device accessible
+ *         the TW_STATUS at which the transfer failed, or I2C_ERROR_TIMEOUT
+ */
+uint8_t i2c_start(uint8_t address, uint8_t mode)
+{
+  i2c_device_t device = i2c_global.bus_default;
+
+  device.address = address;
+
+  return i2c_device_start(&device, mode);
+}
+
+
+/*
+ * Issues a repeated start condition and sends address and transfer direction,
+ * keeping the bus after i2c_start() rather than releasing it with a STOP.
+ * If it fails, the bus is released.
  *
  * Input:   Address and transfer direction of I2C device.
  *
  * Return:  0 device accessible
- *          1 failed to access device
+ *          the TW_STATUS at which the transfer failed, or I2C_ERROR_TIMEOUT
  */
 uint8_t i2c_rep_start(uint8_t address, uint8_t mode)
 {
-  return i2c_start(address, mode);
+  uint8_t rc;
+
+  /* The bus is already ours, so there's no need to wait for the queue */
+  i2c_global.mode = (mode == I2C_WRITE)?I2C_MODE_MT:I2C_MODE_MR;
+
+  rc = i2c_address(address, mode);
+  if(rc)
+    i2c_stop();
+
+  return rc;
 }
 
 
 /*
- * Terminates the data transfer and releases the I2C bus.
+ * Terminates the data transfer and releases the I2C bus, letting queued
+ * transactions start.  Does nothing if the bus isn't held, such as after a
+ * failed start, which has already released it.
  */
 void i2c_stop(void)
 {
+  /* The bus may already be running queued transactions */
+  if(!i2c_global.blocking)
+    return;
+
   /* Send STOP condition. */
   TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
 
   /* Wait until STOP condition is executed and bus released. */
   I2C_WAIT_SET(TWCR, TWSTO);
+  i2c_note_wait(i2c_wait_loops);
+  I2C_TRACE_END();
 
-  i2c_global.mode = I2C_MODE_IDLE;
-  I2C_ENABLE_ISR();
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    i2c_global.mode = I2C_MODE_IDLE;
+    i2c_global.blocking = 0;
+    I2C_ENABLE_ISR();
+
+    /* Start anything queued from an ISR in the meantime */
+    i2c_next();
+  }
 }
 
 
@@ -203,7 +998,7 @@ void i2c_stop(void)
  * Input:    byte to be transfered
  *
  * Return:   0 write successful
- *           1 write failed
+ *           the TW_STATUS at which the transfer failed, or I2C_ERROR_TIMEOUT
 */
 uint8_t i2c_write(uint8_t data)
 {
@@ -214,30 +1009,37 @@ uint8_t i2c_write(uint8_t data)
   TWCR = _BV(TWINT) | _BV(TWEN);
 
   /* Wait until transmission completed */
-  I2C_WAIT_CLEAR(TWCR, TWINT);
+  if(I2C_WAIT_CLEAR(TWCR, TWINT)) return I2C_ERROR_TIMEOUT;
 
   /* Check value of TWI Status Register. */
   twst = TW_STATUS;
+  I2C_TRACE_RECORD(twst);
   if(twst != TW_MT_DATA_ACK)
+  {
+    i2c_global.statistics.failures++;
     return twst;
+  }
 
   return 0;
 }
 
 
 /*
- * Send a string of bytes to I2C device.
+ * Send a string of bytes to I2C device, stopping at the first which fails.
  *
- * Input:    byte to be transfered
+ * Input:    bytes to be transfered, and their count
  *
  * Return:   0 write successful
- *           1 write failed
+ *           the i2c_write() status of the byte which failed
 */
 uint8_t i2c_write_array(uint8_t *data, uint8_t count)
 {
+  uint8_t rc;
+
   while(count--)
   {
-    if(i2c_write(*data++) != 0) return count;
+    rc = i2c_write(*data++);
+    if(rc) return rc;
   }
 
   return 0;
@@ -245,30 +1047,49 @@ uint8_t i2c_write_array(uint8_t *data, uint8_t count)
 
 
 /*
- * Read one byte from the I2C device, request more data from device.
+ * Read one byte from the I2C device, acknowledging it if ack is true.
+ *
+ * Return:  0 read successful
+ *          I2C_ERROR_TIMEOUT
+ */
+static uint8_t i2c_read_byte(uint8_t ack, uint8_t *data)
+{
+  TWCR = _BV(TWINT) | _BV(TWEN) | (ack ? _BV(TWEA) : 0);
+  if(I2C_WAIT_CLEAR(TWCR, TWINT)) return I2C_ERROR_TIMEOUT;
+  I2C_TRACE_RECORD(TW_STATUS);
+
+  *data = TWDR;
+  return 0;
+}
+
+
+/*
+ * Read one byte from the I2C device, request more data from device.  A
+ * timeout can't be reported, so use i2c_read_many() to detect one.
  *
- * Return:  byte read from I2C device
+ * Return:  byte read from I2C device, or 0xff on timeout
  */
 uint8_t i2c_read_ack(void)
 {
-  TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWEA);
-  I2C_WAIT_CLEAR(TWCR, TWINT);
+  uint8_t data = 0xff;
 
-  return TWDR;
+  i2c_read_byte(1, &data);
+  return data;
 }
 
 
 /*
- * Read one byte from the I2C device, read is followed by a STOP condition
+ * Read one byte from the I2C device, read is followed by a STOP condition.
+ * A timeout can't be reported, so use i2c_read_many() to detect one.
  *
- * Return:  byte read from I2C device
+ * Return:  byte read from I2C device, or 0xff on timeout
  */
 uint8_t i2c_read_nak(void)
 {
-  TWCR = _BV(TWINT) | _BV(TWEN);
-  I2C_WAIT_CLEAR(TWCR, TWINT);
+  uint8_t data = 0xff;
 
-  return TWDR;
+  i2c_read_byte(0, &data);
+  return data;
 }
 
 
@@ -276,14 +1097,275 @@ uint8_t i2c_read_nak(void)
  * Read multiple bytes from the I2C device, read may be followed by a STOP
  * condition if nak_last is true.
  *
- * Return:  zero
+ * Return:  0 read successful
+ *          I2C_ERROR_TIMEOUT
  */
 uint8_t i2c_read_many(uint8_t *buffer, uint8_t count, uint8_t nak_last)
 {
   while(count--)
   {
-    *buffer++ = i2c_read(!(nak_last && (count==0)));
+    if(i2c_read_byte(!(nak_last && (count==0)), buffer++))
+      return I2C_ERROR_TIMEOUT;
   }
 
   return 0;
 }
+
+
+/*
+ * Write write_length bytes to device, at its speed, then read read_length
+ * bytes back from it after a repeated START, acknowledging all but the last
+ * byte read.  Either length may be zero.  The bus is always released with a
+ * STOP.
+ *
+ * Return:  0 transfer successful
+ *          the TW_STATUS at which the transfer failed, or I2C_ERROR_TIMEOUT
+ */
+uint8_t i2c_write_read(const i2c_device_t *device,
+                       uint8_t *write_buffer, uint8_t write_length,
+                       uint8_t *read_buffer, uint8_t read_length)
+{
+  uint8_t rc = 0;
+
+  if(write_length || !read_length)
+  {
+    rc = i2c_device_start(device, I2C_WRITE);
+    while(!rc && write_length--)
+      rc = i2c_write(*write_buffer++);
+
+    if(!rc && read_length)
+    {
+#if I2C_TRACE
+      i2c_trace.address |= I2C_READ;
+#endif
+      rc = i2c_rep_start(device->address, I2C_READ);
+    }
+  }
+  else
+  {
+    rc = i2c_device_start(device, I2C_READ);
+  }
+
+  if(!rc)
+    rc = i2c_read_many(read_buffer, read_length, 1);
+
+  i2c_stop();
+
+  return rc;
+}
+
+
+/*
+ * Queue a transaction, to be carried out by the TWI ISR after any already
+ * queued.  If the bus is idle, it is started immediately.
+ *
+ * Return:  0 transaction queued
+ *          I2C_PENDING if the transaction was already queued
+ */
+uint8_t i2c_submit(i2c_transaction_t *transaction)
+{
+  uint8_t rc = 0;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if(transaction->status == I2C_PENDING)
+    {
+      rc = I2C_PENDING;
+    }
+    else
+    {
+      transaction->status = I2C_PENDING;
+      transaction->next = NULL;
+
+      if(i2c_global.last)
+        i2c_global.last->next = transaction;
+      else
+        i2c_global.transaction = transaction;
+      i2c_global.last = transaction;
+
+      i2c_next();
+    }
+  }
+
+  return rc;
+}
+
+
+/*
+ * Wait for a queued transaction to complete.  Interrupts must be enabled.
+ *
+ * Return:  the transaction's status, 0 if successful
+ */
+uint8_t i2c_transaction_wait(i2c_transaction_t *transaction)
+{
+  i2c_wait_queue(transaction);
+
+  return transaction->status;
+}
+
+
+/*
+ * Free a bus held by a stuck slave, then reinitialize the TWI.  Any slave
+ * part-way through sending a byte is clocked (up to 9 times) until it
+ * releases SDA, and a STOP condition is sent by hand.  A queued transaction
+ * in progress fails with I2C_ERROR_TIMEOUT, and the next (if any) is started.
+ */
+void i2c_recover(void)
+{
+  uint8_t port, ddr, pulse;
+
+  I2C_TRACE_RECORD(I2C_TRACE_RECOVER);
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    i2c_global.statistics.recoveries++;
+
+    port = I2C_PORT & (I2C_SCL | I2C_SDA);
+    ddr  = I2C_DDR  & (I2C_SCL | I2C_SDA);
+
+    /* Take the pins back from the TWI, released (high) with any pullups */
+    TWCR = 0;
+    I2C_DDR  &= ~(I2C_SCL | I2C_SDA);
+
+    /* Clock out whatever the slave is sending until it releases SDA */
+    for(pulse = 0; pulse < 9 && !(I2C_PIN & I2C_SDA); pulse++)
+    {
+      I2C_PORT &= ~I2C_SCL;
+      I2C_DDR  |= I2C_SCL;
+      _delay_us(I2C_RECOVER_DELAY_US);
+      I2C_DDR  &= ~I2C_SCL;
+      I2C_PORT |= port & I2C_SCL;
+      _delay_us(I2C_RECOVER_DELAY_US);
+    }
+
+    /* STOP: SDA rising while SCL is high */
+    I2C_PORT &= ~I2C_SDA;
+    I2C_DDR  |= I2C_SDA;
+    _delay_us(I2C_RECOVER_DELAY_US);
+    I2C_DDR  &= ~I2C_SDA;
+    I2C_PORT |= port & I2C_SDA;
+    _delay_us(I2C_RECOVER_DELAY_US);
+
+    I2C_DDR  |= ddr;
+
+    /* Reinitialize the TWI, keeping the bit rate and slave address */
+    TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE) | i2c_global.slave_ack;
+
+    /*
+     * A blocking transfer keeps the bus until its i2c_stop(), failing as it
+     * goes, so nothing queued may start before then.
+     */
+    if(!i2c_global.blocking)
+    {
+      if(i2c_global.transaction
+          && (i2c_global.mode == I2C_MODE_MT || i2c_global.mode == I2C_MODE_MR))
+      {
+        i2c_master_complete(I2C_ERROR_TIMEOUT);
+      }
+      else
+      {
+        i2c_global.mode = I2C_MODE_IDLE;
+        i2c_next();
+      }
+    }
+  }
+}
+
+
+void i2c_get_statistics(i2c_statistics_t *statistics)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    *statistics = i2c_global.statistics;
+  }
+}
+
+void i2c_reset_statistics(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    memset((void *)&i2c_global.statistics, 0, sizeof(i2c_global.statistics));
+  }
+}
+
+#if I2C_TRACE
+/*
+ * Write length bytes of value (little-endian) to stream, adding them to the
+ * checksum.
+ */
+static void i2c_trace_put(FILE *stream, uint8_t *checksum,
+                          uint32_t value, uint8_t length)
+{
+  while(length--)
+  {
+    fputc(value & 0xff, stream);
+    *checksum ^= value & 0xff;
+    value >>= 8;
+  }
+}
+
+/*
+ * Write the trace ring, oldest entry first, and the per-address counters to
+ * stream, emptying the ring.  See i2c.h for the format.
+ */
+void i2c_trace_dump(FILE *stream)
+{
+  uint8_t checksum = 0;
+  uint8_t count, tail, i;
+  uint16_t dropped;
+  i2c_address_statistics_t statistics;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    i2c_trace.paused = 1;
+    count = i2c_trace.count;
+    dropped = i2c_trace.dropped;
+  }
+  tail = (i2c_trace.head - count) & (I2C_TRACE_SIZE - 1);
+
+  fputs(I2C_TRACE_MAGIC, stream);
+  i2c_trace_put(stream, &checksum, I2C_TRACE_VERSION, 1);
+  i2c_trace_put(stream, &checksum, I2C_TRACE_COUNTER_HZ, 4);
+  i2c_trace_put(stream, &checksum, dropped, 2);
+
+  i2c_trace_put(stream, &checksum, count, 1);
+  for(i = 0; i < count; i++, tail = (tail + 1) & (I2C_TRACE_SIZE - 1))
+  {
+    i2c_trace_put(stream, &checksum, i2c_trace.entry[tail].time, 2);
+    i2c_trace_put(stream, &checksum, i2c_trace.entry[tail].status, 1);
+    i2c_trace_put(stream, &checksum, i2c_trace.entry[tail].address, 1);
+  }
+
+  i2c_trace_put(stream, &checksum, i2c_trace.address_count, 1);
+  for(i = 0; i < i2c_trace.address_count; i++)
+  {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      statistics = i2c_trace.addresses[i];
+    }
+    i2c_trace_put(stream, &checksum, statistics.address, 1);
+    i2c_trace_put(stream, &checksum, statistics.transactions, 2);
+    i2c_trace_put(stream, &checksum, statistics.naks, 2);
+    i2c_trace_put(stream, &checksum, statistics.arbitration_lost, 2);
+    i2c_trace_put(stream, &checksum, statistics.timeouts, 2);
+    i2c_trace_put(stream, &checksum, statistics.total_time, 4);
+  }
+
+  fputc(checksum, stream);
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    i2c_trace.count = 0;
+    i2c_trace.dropped = 0;
+    i2c_trace.paused = 0;
+  }
+}
+
+void i2c_trace_reset(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    memset(&i2c_trace, 0, sizeof(i2c_trace));
+  }
+}
+#endif
@@ -30,6 +30,7 @@
 #endif
 
 #include <avr/io.h>
+#include <stdio.h>
 
 /** defines the data direction (reading from I2C device) in i2c_start(),i2c_rep_start() */
 #define I2C_READ    1
@@ -56,14 +57,241 @@ typedef enum _i2c_mode_t
   I2C_MODE_SR
 } i2c_mode_t;
 
+/*
+ * The TWI bit rate settings for the fastest SCL clock no faster than scl Hz:
+ * SCL = F_CPU / (16 + 2 * TWBR * 4^TWPS).  The smallest prescaler which
+ * allows it is used, and the slowest possible clock if none do.
+ */
+#define I2C_DIVIDER(scl)       ((F_CPU + (scl) - 1) / (scl))
+#define I2C_TWBR_FOR(scl, ps) \
+  ((I2C_DIVIDER(scl) > 16) \
+    ? ((I2C_DIVIDER(scl) - 16 + (2UL << (2 * (ps))) - 1) / (2UL << (2 * (ps)))) \
+    : 0)
+#define I2C_TWPS(scl) \
+  ( (I2C_TWBR_FOR(scl, 0) <= 255) ? 0 \
+  : (I2C_TWBR_FOR(scl, 1) <= 255) ? 1 \
+  : (I2C_TWBR_FOR(scl, 2) <= 255) ? 2 : 3)
+#define I2C_TWBR(scl) \
+  ((I2C_TWBR_FOR(scl, I2C_TWPS(scl)) <= 255) \
+    ? I2C_TWBR_FOR(scl, I2C_TWPS(scl)) : 255)
+
+/*
+ * A peer on the bus, with the bit rate settings for the fastest SCL clock it
+ * supports, so that each transaction with it runs at its own speed.  Use
+ * I2C_DEVICE() to initialize one, e.g.:
+ *
+ *   i2c_device_t rtc_i2c = I2C_DEVICE(0xD0, 100000UL);
+ */
+typedef struct _i2c_device_t
+{
+  uint8_t address;
+  uint8_t twbr;
+  uint8_t twps;
+} i2c_device_t;
+
+#define I2C_DEVICE(address, max_scl) \
+  { (address), I2C_TWBR(max_scl), I2C_TWPS(max_scl) }
+
 typedef uint8_t (i2c_callback_t)(uint8_t status, i2c_mode_t last_mode, i2c_mode_t current_mode);
 
+/** Status of a transaction which is queued or in progress */
+#define I2C_PENDING 0x01
+
+/** The bus made no progress within I2C_TIMEOUT_US, and was recovered */
+#define I2C_ERROR_TIMEOUT 0x02
+
+/** An illegal START or STOP was seen (TW_BUS_ERROR, which is 0) */
+#define I2C_ERROR_BUS 0x03
+
+typedef struct _i2c_transaction_t i2c_transaction_t;
+
+typedef void (i2c_transaction_callback_t)(i2c_transaction_t *transaction);
+
+/*
+ * An asynchronous master transaction, carried out by the TWI ISR once
+ * queued with i2c_submit().  The write_length bytes of write_buffer are
+ * written to device, at its speed, then read_length bytes are read into
+ * read_buffer, after a repeated START if there was anything to write.
+ * Either length may be zero.  On completion, status is set to 0 if the
+ * transaction succeeded, or to the TW_STATUS at which it failed (or an
+ * I2C_ERROR_* code), and callback (if any) is called from the ISR.  The
+ * transaction and its buffers must remain valid until then.
+ */
+struct _i2c_transaction_t
+{
+  const i2c_device_t *device;
+  uint8_t *write_buffer;
+  uint8_t write_length;
+  uint8_t *read_buffer;
+  uint8_t read_length;
+  i2c_transaction_callback_t *callback;
+  volatile uint8_t status;
+  i2c_transaction_t *next;
+};
+
+/*
+ * Counters of master transactions, both blocking and queued, which failed
+ * or timed out, and of bus recoveries.  max_wait_us is the longest time
+ * (approximately) spent waiting on the bus during one blocking transaction
+ * or in i2c_transaction_wait(), as a measure of worst-case latency.
+ */
+typedef struct _i2c_statistics_t
+{
+  uint16_t transactions;
+  uint16_t failures;
+  uint16_t timeouts;
+  uint16_t recoveries;
+  uint16_t max_wait_us;
+} i2c_statistics_t;
+
+/*
+ * A read-only register file served by the slave, without any callbacks.
+ * The master writes a register address, then reads from it onwards (with
+ * auto-increment, usually after a repeated START).  Each read is served
+ * entirely from the front buffer, while the application fills the back
+ * buffer and publishes it with i2c_registers_publish(), which swaps the two
+ * atomically (or at the end of a read in progress).
+ */
+typedef struct _i2c_registers_t
+{
+  uint8_t *buffer[2];
+  uint8_t size;
+  uint8_t front;
+  uint8_t pending;
+  uint8_t pointer;
+  uint8_t addressed;
+} i2c_registers_t;
+
+/** The master wrote more than rx_size bytes, or read past tx_length */
+#define I2C_SLAVE_OVERFLOW 0x01
+
+/** The master ended its read (with a NAK) before the end of tx_length */
+#define I2C_SLAVE_NAK      0x02
+
+typedef void (i2c_slave_callback_t)(i2c_mode_t mode, uint8_t count, uint8_t status);
+
+/*
+ * Buffers for slave transfers handled entirely by the ISR.  Writes from the
+ * master are received into rx_buffer, and reads are served from tx_buffer.
+ * The callback is called (from the ISR) once per transfer, when it ends:
+ * with I2C_MODE_SR and the number of bytes received at the STOP (or
+ * repeated START), or with I2C_MODE_ST and the number of bytes sent once the
+ * master ends its read, along with any I2C_SLAVE_* status flags.  Extra
+ * bytes written are acknowledged but discarded, and 0xff is sent for extra
+ * bytes read.
+ */
+typedef struct _i2c_slave_buffers_t
+{
+  uint8_t *rx_buffer;
+  uint8_t rx_size;
+  uint8_t *tx_buffer;
+  uint8_t tx_length;
+  i2c_slave_callback_t *callback;
+  uint8_t count;
+  uint8_t status;
+} i2c_slave_buffers_t;
+
+/*
+ * Optionally, with I2C_TRACE, record each TW_STATUS seen by the ISR and the
+ * blocking functions (plus the I2C_TRACE_* events) in a ring of
+ * I2C_TRACE_SIZE entries, stamped with I2C_TRACE_COUNTER, a free-running
+ * 16-bit counter running at I2C_TRACE_COUNTER_HZ, and keep counters for up
+ * to I2C_TRACE_ADDRESSES addresses the master has accessed.  Dump both with
+ * i2c_trace_dump(), and decode them with i2c_trace_decode.py.
+ */
+#ifndef I2C_TRACE
+#define I2C_TRACE 0
+#endif
+
+#if I2C_TRACE
+
+#ifndef I2C_TRACE_SIZE
+#define I2C_TRACE_SIZE 64
+#endif
+
+#if (I2C_TRACE_SIZE & (I2C_TRACE_SIZE - 1)) || I2C_TRACE_SIZE > 128
+#error "I2C_TRACE_SIZE must be a power of 2, no larger than 128!"
+#endif
+
+#ifndef I2C_TRACE_ADDRESSES
+#define I2C_TRACE_ADDRESSES 8
+#endif
+
+#ifndef I2C_TRACE_COUNTER
+#error "I2C_TRACE requires I2C_TRACE_COUNTER!"
+#endif
+
+#ifndef I2C_TRACE_COUNTER_HZ
+#define I2C_TRACE_COUNTER_HZ F_CPU
+#endif
+
+/* Trace events, which can't be mistaken for TW_STATUS (a multiple of 8) */
+#define I2C_TRACE_STOP    0x01
+#define I2C_TRACE_TIMEOUT 0x02
+#define I2C_TRACE_RECOVER 0x03
+#define I2C_TRACE_START   0x04
+
+/* Marks the start of a dump from i2c_trace_dump() */
+#define I2C_TRACE_MAGIC   "I2CT"
+#define I2C_TRACE_VERSION 1
+
+typedef struct _i2c_trace_entry_t
+{
+  uint16_t time;
+  uint8_t status;
+  uint8_t address;
+} i2c_trace_entry_t;
+
+/*
+ * Counters for master transactions with one address.  The average duration
+ * of a transaction, in counter ticks, is total_time / transactions.
+ */
+typedef struct _i2c_address_statistics_t
+{
+  uint8_t address;
+  uint16_t transactions;
+  uint16_t naks;
+  uint16_t arbitration_lost;
+  uint16_t timeouts;
+  uint32_t total_time;
+} i2c_address_statistics_t;
+
+typedef struct _i2c_trace_t
+{
+  i2c_trace_entry_t entry[I2C_TRACE_SIZE];
+  uint8_t head;
+  uint8_t count;
+  uint16_t dropped;
+  uint8_t paused;
+  uint8_t active;
+  uint8_t address;
+  uint8_t result;
+  uint16_t start;
+  i2c_address_statistics_t addresses[I2C_TRACE_ADDRESSES];
+  uint8_t address_count;
+} i2c_trace_t;
+
+extern i2c_trace_t i2c_trace;
+
+#endif
+
 typedef struct _i2c_t
 {
   i2c_mode_t mode;
   i2c_callback_t *st_callback;
   i2c_callback_t *sr_callback;
   i2c_callback_t *stop_callback;
+  i2c_registers_t *registers;
+  i2c_slave_buffers_t *slave_buffers;
+  i2c_transaction_t *transaction;
+  i2c_transaction_t *last;
+  uint8_t position;
+  uint8_t reading;
+  uint8_t slave_ack;
+  uint8_t blocking;
+  uint8_t steps;
+  i2c_device_t bus_default;
+  i2c_statistics_t statistics;
 } i2c_t;
 
 extern volatile i2c_t i2c_global;
@@ -77,8 +305,44 @@ extern void i2c_init(void);
 
 extern uint8_t i2c_slave_init(uint8_t address, uint8_t address_mask, uint8_t gcall);
 
+/**
+ @brief serve a register file as slave, instead of the st/sr callbacks
+ @param  registers  the register file to initialize
+ @param  front  the buffer served first, of size bytes
+ @param  back  the buffer first returned by i2c_registers_back()
+ */
+extern void i2c_slave_registers(i2c_registers_t *registers,
+                                void *front, void *back, uint8_t size);
+
+/**
+ @brief serve slave transfers from buffers, instead of the st/sr callbacks
+
+ The tx_buffer and tx_length may be changed later, with interrupts disabled.
+
+ @param  buffers  the buffers to initialize
+ @param  callback  called once at the end of each transfer, or NULL
+ */
+extern void i2c_slave_buffers(i2c_slave_buffers_t *buffers,
+                              uint8_t *rx_buffer, uint8_t rx_size,
+                              uint8_t *tx_buffer, uint8_t tx_length,
+                              i2c_slave_callback_t *callback);
+
+/**
+ @brief get the back buffer of a register file to fill
+ @return  the buffer, or NULL if the last one published isn't served yet
+ */
+extern void *i2c_registers_back(i2c_registers_t *registers);
+
+/**
+ @brief publish the back buffer, to be served to the master from now on
+ */
+extern void i2c_registers_publish(i2c_registers_t *registers);
+
 /** 
  @brief Terminates the data transfer and releases the I2C bus 
+
+ Does nothing if the bus isn't held, such as after a failed start.
+
  @param void
  @return none
  */
@@ -87,20 +351,43 @@ extern void i2c_stop(void);
 
 /** 
  @brief Issues a start condition and sends address and transfer direction 
-  
+
+ On success, the bus is held until i2c_stop(), which must be called on every
+ path (including when a later i2c_write() fails), as no queued transaction
+ can start until then.  On failure, the bus has already been released, and
+ calling i2c_stop() is harmless.
+
  @param    addr address and transfer direction of I2C device
  @retval   0   device accessible 
- @retval   1   failed to access device 
+ @return   otherwise the TW_STATUS at which the transfer failed, or
+           I2C_ERROR_TIMEOUT
  */
 extern uint8_t i2c_start(uint8_t address, uint8_t mode);
 
+/**
+ @brief Issues a start condition to a device, at its speed, and sends its
+        address and transfer direction
+
+ The bus is held until i2c_stop(), as for i2c_start().
+
+ @param   device the I2C device
+ @param   mode I2C_READ or I2C_WRITE
+ @retval  0 device accessible
+ @return  otherwise the TW_STATUS at which the transfer failed, or
+          I2C_ERROR_TIMEOUT
+ */
+extern uint8_t i2c_device_start(const i2c_device_t *device, uint8_t mode);
+
 
 /**
  @brief Issues a repeated start condition and sends address and transfer direction 
 
+ On failure, the bus is released, as for i2c_start().
+
  @param   addr address and transfer direction of I2C device
  @retval  0 device accessible
- @retval  1 failed to access device
+ @return  otherwise the TW_STATUS at which the transfer failed, or
+          I2C_ERROR_TIMEOUT
  */
 extern uint8_t i2c_rep_start(uint8_t address, uint8_t mode);
 
@@ -119,21 +406,37 @@ extern void i2c_start_wait(uint8_t address, uint8_t mode);
  @brief Send one byte to I2C device
  @param    data  byte to be transfered
  @retval   0 write successful
- @retval   1 write failed
+ @return   otherwise the TW_STATUS at which the transfer failed, or
+           I2C_ERROR_TIMEOUT
  */
 extern uint8_t i2c_write(uint8_t data);
 
+/**
+ @brief Send count bytes to I2C device, stopping at the first which fails
+ @param    data  bytes to be transfered
+ @param    count  number of bytes
+ @retval   0 write successful
+ @return   otherwise the i2c_write() status of the byte which failed
+ */
 extern uint8_t i2c_write_array(uint8_t *data, uint8_t count);
 
 /**
  @brief    read one byte from the I2C device, request more data from device 
- @return   byte read from I2C device
+
+ A timeout can't be told apart from data, as 0xff is returned; use
+ i2c_read_many() where it needs to be detected.
+
+ @return   byte read from I2C device, or 0xff on timeout
  */
 extern uint8_t i2c_read_ack(void);
 
 /**
  @brief    read one byte from the I2C device, read is followed by a stop condition 
- @return   byte read from I2C device
+
+ A timeout can't be told apart from data, as 0xff is returned; use
+ i2c_read_many() where it needs to be detected.
+
+ @return   byte read from I2C device, or 0xff on timeout
  */
 extern uint8_t i2c_read_nak(void);
 
@@ -149,7 +452,79 @@ extern uint8_t i2c_read_nak(void);
 extern uint8_t i2c_read(uint8_t ack);
 #define i2c_read(ack)  ((ack) ? i2c_read_ack() : i2c_read_nak())
 
+/**
+ @brief    read count bytes from the I2C device, acknowledging each but
+           (if nak_last is true) the last
+ @retval   0 read successful
+ @retval   I2C_ERROR_TIMEOUT
+ */
 extern uint8_t i2c_read_many(uint8_t *buffer, uint8_t count, uint8_t nak_last);
 
+/**
+ @brief    write to a device, then read from it after a repeated START
+
+ The last byte read is not acknowledged, and the bus is released with a
+ STOP whether or not the transfer succeeds.
+
+ @param    device  the I2C device, accessed at its speed
+ @param    write_buffer  bytes to write, such as a register address
+ @param    write_length  number of bytes to write, may be zero
+ @param    read_buffer  buffer for the bytes read
+ @param    read_length  number of bytes to read, may be zero
+ @retval   0 transfer successful
+ @return   otherwise the TW_STATUS at which the transfer failed, or
+           I2C_ERROR_TIMEOUT
+ */
+extern uint8_t i2c_write_read(const i2c_device_t *device,
+                              uint8_t *write_buffer, uint8_t write_length,
+                              uint8_t *read_buffer, uint8_t read_length);
+
+/**
+ @brief    queue a transaction to be carried out by the TWI ISR
+
+ The blocking functions above wait for all queued transactions to complete
+ before starting.
+
+ @param    transaction  the transaction, whose status is set to I2C_PENDING
+ @retval   0 transaction queued
+ @retval   I2C_PENDING the transaction was already queued
+ */
+extern uint8_t i2c_submit(i2c_transaction_t *transaction);
+
+/**
+ @brief    wait for a queued transaction to complete, with interrupts enabled
+ @return   the transaction's status
+ */
+extern uint8_t i2c_transaction_wait(i2c_transaction_t *transaction);
+
+/**
+ @brief    free a stuck bus and reinitialize the TWI
+
+ Called automatically when any wait on the bus times out.  Up to 9 clock
+ pulses are sent until SDA is released, followed by a STOP condition.
+ */
+extern void i2c_recover(void);
+
+extern void i2c_get_statistics(i2c_statistics_t *statistics);
+extern void i2c_reset_statistics(void);
+
+#if I2C_TRACE
+/**
+ @brief    write the trace ring and per-address counters to stream, in binary
+
+ The dump is I2C_TRACE_MAGIC, then (little-endian) the version, the counter
+ frequency (4 bytes), the number of entries dropped before the oldest
+ (2 bytes), the number of entries followed by each entry oldest first (as
+ i2c_trace_entry_t), the number of addresses followed by each address's
+ counters (as i2c_address_statistics_t), and an XOR of all bytes after the
+ magic.  Entries aren't recorded while dumping.  The stream must pass every
+ byte through unchanged, so not a UART stream with UART_STREAM_CRLF (such
+ as stdout from uart_init_stdout()), which sends 0x0A as 0x0D 0x0A.
+ */
+extern void i2c_trace_dump(FILE *stream);
+
+extern void i2c_trace_reset(void);
+#endif
+
 /**@}*/
 #endif
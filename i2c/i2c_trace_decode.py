@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+#
+#   Copyright (c) 2010, Jeremy Cole <jeremy@jcole.us>
+#
+#   This program is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation; either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+"""Decode i2c_trace_dump() output from a serial console.
+
+Reads the console output of an application built with I2C_TRACE (from a
+file, or standard input, e.g. a serial port), finds each binary trace dump
+in it, and prints the trace as a timeline of bus events followed by the
+counters for each address.  Anything else is ignored.
+
+  i2c_trace_decode.py < /dev/ttyUSB0
+"""
+
+import os
+import struct
+import sys
+
+MAGIC = b"I2CT"
+VERSION = 1
+HEADER = struct.Struct("<BIHB")
+ENTRY = struct.Struct("<HBB")
+ADDRESS = struct.Struct("<BHHHHI")
+
+# From <util/twi.h>, plus the I2C_TRACE_* events from i2c.h.
+STATUS = {
+    0x00: "bus error",
+    0x01: "STOP (transaction end)",
+    0x02: "timeout",
+    0x03: "bus recovery",
+    0x04: "transaction begin",
+    0x08: "START",
+    0x10: "repeated START",
+    0x18: "MT SLA+W ACK",
+    0x20: "MT SLA+W NACK",
+    0x28: "MT data ACK",
+    0x30: "MT data NACK",
+    0x38: "arbitration lost",
+    0x40: "MR SLA+R ACK",
+    0x48: "MR SLA+R NACK",
+    0x50: "MR data ACK",
+    0x58: "MR data NACK",
+    0x60: "SR SLA+W ACK",
+    0x68: "SR arbitration lost, SLA+W ACK",
+    0x70: "SR general call ACK",
+    0x78: "SR arbitration lost, general call ACK",
+    0x80: "SR data ACK",
+    0x88: "SR data NACK",
+    0x90: "SR general call data ACK",
+    0x98: "SR general call data NACK",
+    0xA0: "SR STOP or repeated START",
+    0xA8: "ST SLA+R ACK",
+    0xB0: "ST arbitration lost, SLA+R ACK",
+    0xB8: "ST data ACK",
+    0xC0: "ST data NACK",
+    0xC8: "ST last data ACK",
+    0xF8: "no information",
+}
+
+
+def parse(buffer, position):
+  """Parse the dump at position, returning (dump, end) or None if invalid."""
+  start = position + len(MAGIC)
+  try:
+    version, hz, dropped, count = HEADER.unpack_from(buffer, start)
+    if version != VERSION:
+      return None
+    offset = start + HEADER.size
+    entries = []
+    for _ in range(count):
+      entries.append(ENTRY.unpack_from(buffer, offset))
+      offset += ENTRY.size
+    (address_count,) = struct.unpack_from("<B", buffer, offset)
+    offset += 1
+    addresses = []
+    for _ in range(address_count):
+      addresses.append(ADDRESS.unpack_from(buffer, offset))
+      offset += ADDRESS.size
+    (checksum,) = struct.unpack_from("<B", buffer, offset)
+  except struct.error:
+    return None
+
+  for byte in buffer[start:offset]:
+    checksum ^= byte
+  if checksum != 0 or hz == 0:
+    return None
+
+  return (hz, dropped, entries, addresses), offset + 1
+
+
+def print_dump(dump, out):
+  hz, dropped, entries, addresses = dump
+
+  out.write("I2C trace: %d entries" % len(entries))
+  if dropped:
+    out.write(", %d older entries dropped" % dropped)
+  out.write("\n")
+
+  # Unwrap the 16-bit timestamps, assuming less than one counter period
+  # between consecutive entries.
+  elapsed = 0
+  last = None
+  for time, status, address in entries:
+    if last is not None:
+      elapsed += (time - last) & 0xFFFF
+    last = time
+    name = STATUS.get(status, "status 0x%02x" % status)
+    out.write("  %12.1f us  0x%02x %s  %s\n" % (
+        elapsed * 1e6 / hz, address & 0xFE,
+        "R" if address & 1 else "W", name))
+
+  out.write("\n  addr  transactions  NAKs  arb lost  timeouts  avg us\n")
+  for address, transactions, naks, arbitration, timeouts, total in addresses:
+    average = total * 1e6 / hz / transactions if transactions else 0.0
+    out.write("  0x%02x  %12d  %4d  %8d  %8d  %6.1f\n" % (
+        address & 0xFE, transactions, naks, arbitration, timeouts, average))
+  out.write("\n")
+
+
+def decode(buffer, out, final=False):
+  """Decode the dumps in buffer, returning any incomplete dump at its end."""
+  position = 0
+  while True:
+    position = buffer.find(MAGIC, position)
+    if position < 0:
+      # Keep a possible partial magic at the end.
+      return b"" if final else buffer[-(len(MAGIC) - 1):]
+
+    result = parse(buffer, position)
+    if result is None:
+      if not final and len(buffer) - position < 1024:
+        # Possibly incomplete, so wait for more.
+        return buffer[position:]
+      position += 1
+      continue
+
+    dump, position = result
+    print_dump(dump, out)
+
+
+def main(argv):
+  if len(argv) not in (1, 2):
+    sys.stderr.write("usage: %s [<console capture>]\n" % argv[0])
+    return 1
+
+  fd = os.open(argv[1], os.O_RDONLY) if len(argv) == 2 else sys.stdin.fileno()
+
+  pending = b""
+  while True:
+    data = os.read(fd, 4096)
+    if not data:
+      break
+    pending = decode(pending + data, sys.stdout)
+    sys.stdout.flush()
+
+  decode(pending, sys.stdout, final=True)
+  return 0
+
+
+if __name__ == "__main__":
+  sys.exit(main(sys.argv))
@@ -0,0 +1,38 @@
+/*
+    Copyright (c) 2010, Jeremy Cole <jeremy@jcole.us>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Host stand-in for avr-libc's <avr/interrupt.h>.  The TWI ISR is an
+ * ordinary function, called by the simulated TWI in i2c_host.c from
+ * i2c_host_run(), so it never preempts the code under test.
+ */
+
+#ifndef I2C_HOST_AVR_INTERRUPT_H
+#define I2C_HOST_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+#define ISR(vector, ...) void vector(void); void vector(void)
+
+#define sei()
+#define cli()
+
+extern void TWI_vect(void);
+
+#endif /* I2C_HOST_AVR_INTERRUPT_H */
@@ -0,0 +1,66 @@
+/*
+    Copyright (c) 2010, Jeremy Cole <jeremy@jcole.us>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Host stand-in for avr-libc's <avr/io.h>, providing the TWI registers and
+ * TWI port of an ATmega644P as plain variables, which are driven by the
+ * simulated TWI in i2c_host.c.  TWCR is read and written through
+ * i2c_host_control(), so that the TWI can carry out each command written to
+ * it before TWCR is next used, and TWSR through i2c_host_status(), as only
+ * its prescaler bits can be written.
+ */
+
+#ifndef I2C_HOST_AVR_IO_H
+#define I2C_HOST_AVR_IO_H
+
+#include <inttypes.h>
+
+#define _BV(bit) (1 << (bit))
+
+extern volatile uint8_t TWBR, TWAR, TWDR, TWAMR;
+extern volatile uint8_t PORTC, DDRC, PINC;
+
+extern volatile uint8_t *i2c_host_control(void);
+extern volatile uint8_t *i2c_host_status(void);
+#define TWCR (*i2c_host_control())
+#define TWSR (*i2c_host_status())
+
+/* TWCR */
+#define TWINT   7
+#define TWEA    6
+#define TWSTA   5
+#define TWSTO   4
+#define TWWC    3
+#define TWEN    2
+#define TWIE    0
+
+/* TWSR */
+#define TWPS1   1
+#define TWPS0   0
+
+/* PORTC */
+#define PC0     0
+#define PC1     1
+
+#define TWI_vect  i2c_host_twi
+
+/* A free-running counter for I2C_TRACE_COUNTER */
+extern uint16_t i2c_host_timer(void);
+
+#endif /* I2C_HOST_AVR_IO_H */
@@ -0,0 +1,294 @@
+/*
+    Copyright (c) 2010, Jeremy Cole <jeremy@jcole.us>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/twi.h>
+
+#include "i2c_host.h"
+
+volatile uint8_t TWBR, TWAR, TWDR, TWAMR;
+volatile uint8_t PORTC, DDRC, PINC;
+
+/*
+ * TWCR as the code under test last left it, and as the TWI last left it.
+ * When they differ, the code has written TWCR since.  Each completed
+ * command is marked with TWWC, which the library never writes, so that
+ * writing the same command again is seen as a new one.
+ */
+static volatile uint8_t i2c_host_twcr;
+static uint8_t i2c_host_twcr_seen;
+
+/* TWSR, and the status bits the TWI last set in it */
+static volatile uint8_t i2c_host_twsr;
+static uint8_t i2c_host_twsr_status;
+
+i2c_host_t i2c_host;
+
+/*
+ * Advance by one each time it's read, so that trace entries are stamped in
+ * order, and every transaction takes some time.
+ */
+uint16_t i2c_host_timer(void)
+{
+  static uint16_t ticks;
+
+  return ticks++;
+}
+
+/*
+ * Reset the simulated TWI and bus, as at power on, with no slaves.
+ */
+void i2c_host_reset(void)
+{
+  memset(&i2c_host, 0, sizeof(i2c_host));
+
+  TWBR = 0;
+  i2c_host_twsr = 0;
+  i2c_host_twsr_status = TW_NO_INFO;
+  TWAR = 0;
+  TWDR = 0xff;
+  TWAMR = 0;
+  i2c_host_twcr = 0;
+  i2c_host_twcr_seen = 0;
+
+  /* SCL and SDA released, and pulled up */
+  PORTC = 0;
+  DDRC = 0;
+  PINC = _BV(PC0) | _BV(PC1);
+}
+
+/*
+ * Add a slave at address (with the R/W bit clear), its registers zeroed.
+ */
+i2c_host_device_t *i2c_host_add_device(uint8_t address)
+{
+  i2c_host_device_t *device;
+
+  if(i2c_host.device_count == I2C_HOST_DEVICES)
+    abort();
+
+  device = &i2c_host.devices[i2c_host.device_count++];
+  device->address = address;
+
+  return device;
+}
+
+static i2c_host_device_t *i2c_host_find(uint8_t address)
+{
+  uint8_t i;
+
+  for(i = 0; i < i2c_host.device_count; i++)
+    if(i2c_host.devices[i].address == (address & ~I2C_READ))
+      return &i2c_host.devices[i];
+
+  return NULL;
+}
+
+/*
+ * Carry out one step of a transfer, with the bus held, after TWINT was
+ * written with neither TWSTA nor TWSTO.  Return the new status.
+ */
+static uint8_t i2c_host_transfer(uint8_t control)
+{
+  i2c_host_device_t *device = i2c_host.device;
+
+  switch(TW_STATUS)
+  {
+  case TW_START:
+  case TW_REP_START:
+    device = i2c_host.device = i2c_host_find(TWDR);
+    if(!device || device->nak)
+    {
+      i2c_host.device = NULL;
+      return (TWDR & I2C_READ) ? TW_MR_SLA_NACK : TW_MT_SLA_NACK;
+    }
+    device->twbr = TWBR;
+    device->start_twbr = i2c_host.start_twbr;
+    device->transfers++;
+    device->addressed = 1;
+    return (TWDR & I2C_READ) ? TW_MR_SLA_ACK : TW_MT_SLA_ACK;
+
+  case TW_MT_SLA_ACK:
+  case TW_MT_DATA_ACK:
+    if(device->addressed)
+    {
+      device->pointer = TWDR % sizeof(device->registers);
+      device->addressed = 0;
+    }
+    else
+    {
+      device->registers[device->pointer] = TWDR;
+      device->pointer = (device->pointer + 1) % sizeof(device->registers);
+    }
+    return TW_MT_DATA_ACK;
+
+  case TW_MR_SLA_ACK:
+  case TW_MR_DATA_ACK:
+    TWDR = device->registers[device->pointer];
+    device->pointer = (device->pointer + 1) % sizeof(device->registers);
+    return (control & _BV(TWEA)) ? TW_MR_DATA_ACK : TW_MR_DATA_NACK;
+  }
+
+  /* The master kept going after a NAK, rather than a STOP or START */
+  fprintf(stderr, "i2c_host: TWCR 0x%02x after status 0x%02x\n",
+      control, TW_STATUS);
+  abort();
+}
+
+/*
+ * Carry out whatever the code under test has written to TWCR since the
+ * TWI last changed it.
+ */
+static void i2c_host_update(void)
+{
+  uint8_t control = i2c_host_twcr;
+  uint8_t status;
+
+  if(control == i2c_host_twcr_seen)
+    return;
+
+  if(!(control & _BV(TWEN)))
+  {
+    /* Disabling the TWI releases the bus, which is recovered by hand */
+    if(i2c_host_twcr_seen & _BV(TWEN))
+    {
+      i2c_host.owned = 0;
+      i2c_host.stuck = 0;
+      i2c_host.device = NULL;
+    }
+    i2c_host_twcr_seen = control;
+    return;
+  }
+
+  if(!(control & _BV(TWINT)))
+  {
+    /* Nothing to do */
+    i2c_host_twcr_seen = control;
+    return;
+  }
+
+  if(i2c_host.stuck)
+  {
+    /* Writing TWINT clears it, but the command never completes */
+    i2c_host_twcr = i2c_host_twcr_seen = control & ~_BV(TWINT);
+    return;
+  }
+
+  if(control & _BV(TWSTO))
+  {
+    /* A STOP alone is only seen in the ISR if it's being waited for */
+    if(i2c_host.in_isr && !(control & _BV(TWSTA)))
+      i2c_host.isr_stop_waits++;
+    if(i2c_host.owned)
+      i2c_host.stops++;
+    i2c_host.owned = 0;
+    i2c_host.device = NULL;
+  }
+
+  if(control & _BV(TWSTA))
+  {
+    status = i2c_host.owned ? TW_REP_START : TW_START;
+    i2c_host.start_twbr = TWBR;
+    i2c_host.owned = 1;
+    i2c_host.starts++;
+  }
+  else if(control & _BV(TWSTO) || !i2c_host.owned)
+  {
+    /* A STOP doesn't set TWINT, and nor does a slave without its address */
+    i2c_host_twcr = i2c_host_twcr_seen =
+      control & ~(_BV(TWINT) | _BV(TWSTO));
+    return;
+  }
+  else
+  {
+    status = i2c_host_transfer(control);
+  }
+
+  i2c_host_twsr_status = status;
+  i2c_host_twcr = i2c_host_twcr_seen =
+    (control & ~(_BV(TWSTA) | _BV(TWSTO))) | _BV(TWINT) | _BV(TWWC);
+}
+
+/*
+ * TWCR, once the TWI has carried out any command written to it.
+ */
+volatile uint8_t *i2c_host_control(void)
+{
+  i2c_host_update();
+
+  return &i2c_host_twcr;
+}
+
+/*
+ * TWSR, with the status bits restored after any write to it.
+ */
+volatile uint8_t *i2c_host_status(void)
+{
+  i2c_host_twsr = (i2c_host_twsr & (_BV(TWPS1) | _BV(TWPS0)))
+    | i2c_host_twsr_status;
+
+  return &i2c_host_twsr;
+}
+
+/*
+ * Act as another master on the bus, with the TWI addressed as a slave: set
+ * status (a TW_SR_* or TW_ST_* status), with data in TWDR, and call the ISR
+ * for it.  Return TWDR afterwards, which after a TW_ST_* status is the next
+ * byte the slave sends.
+ */
+uint8_t i2c_host_slave(uint8_t status, uint8_t data)
+{
+  i2c_host_twsr_status = status;
+  TWDR = data;
+  i2c_host_twcr = i2c_host_twcr_seen =
+    i2c_host_twcr_seen | _BV(TWINT) | _BV(TWWC);
+
+  i2c_host.in_isr = 1;
+  TWI_vect();
+  i2c_host.in_isr = 0;
+  i2c_host_update();
+
+  return TWDR;
+}
+
+/*
+ * Let the TWI carry out any command pending, calling the ISR for as long as
+ * it raises an interrupt.
+ */
+void i2c_host_run(void)
+{
+  uint16_t calls = 0;
+  uint8_t irq = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+
+  i2c_host_update();
+  while((i2c_host_twcr & irq) == irq)
+  {
+    /* An ISR which never clears TWINT would hang the hardware */
+    if(++calls > 1000)
+      abort();
+    i2c_host.in_isr = 1;
+    TWI_vect();
+    i2c_host.in_isr = 0;
+    i2c_host_update();
+  }
+}
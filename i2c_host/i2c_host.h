@@ -0,0 +1,78 @@
+/*
+    Copyright (c) 2010, Jeremy Cole <jeremy@jcole.us>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef I2C_HOST_H
+#define I2C_HOST_H
+
+#include <inttypes.h>
+
+#include "i2c.h"
+
+/*
+ * A simulated slave on the bus, with a DS1307-style register file: the
+ * first byte written after its address sets the register pointer, further
+ * bytes written are stored from there, and reads continue from there, with
+ * the pointer wrapping at the end.  If nak is set, it doesn't acknowledge
+ * its address.  twbr and start_twbr are the bit rate settings (TWBR) at
+ * which the master last sent its address, and the START before it.
+ */
+typedef struct _i2c_host_device_t
+{
+  uint8_t address;
+  uint8_t nak;
+  uint8_t registers[64];
+  uint8_t pointer;
+  uint8_t addressed;
+  uint8_t twbr;
+  uint8_t start_twbr;
+  uint16_t transfers;
+} i2c_host_device_t;
+
+/*
+ * The simulated TWI, as a master on a bus with up to I2C_HOST_DEVICES
+ * slaves, or as a slave addressed by another master driven by
+ * i2c_host_slave().  Each command written to TWCR completes before TWCR is next used,
+ * except while stuck is set, when the bus hangs (as if a slave held SDA)
+ * until the TWI is disabled and the bus recovered.  isr_stop_waits counts
+ * the STOPs which the ISR waited for, rather than returning.
+ */
+#define I2C_HOST_DEVICES 4
+
+typedef struct _i2c_host_t
+{
+  i2c_host_device_t devices[I2C_HOST_DEVICES];
+  uint8_t device_count;
+  i2c_host_device_t *device;
+  uint8_t owned;
+  uint8_t stuck;
+  uint16_t starts;
+  uint16_t stops;
+  uint8_t start_twbr;
+  uint8_t in_isr;
+  uint16_t isr_stop_waits;
+} i2c_host_t;
+
+extern i2c_host_t i2c_host;
+
+extern void i2c_host_reset(void);
+extern i2c_host_device_t *i2c_host_add_device(uint8_t address);
+extern void i2c_host_run(void);
+extern uint8_t i2c_host_slave(uint8_t status, uint8_t data);
+
+#endif /* I2C_HOST_H */
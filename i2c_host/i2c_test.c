@@ -0,0 +1,623 @@
+/*
+    Copyright (c) 2010, Jeremy Cole <jeremy@jcole.us>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Tests of the I2C master's queue and bus recovery, run against the
+ * simulated TWI of i2c_host.c, with a DS1307 RTC and a remote LCD (as
+ * driven by led_analog_clock) on the bus.  Each test checks that the
+ * queue keeps running after a blocking transfer fails or misbehaves.  The
+ * slave side is tested by driving the ISR with the statuses another master
+ * would cause, as gps_i2c is read by led_analog_clock.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "i2c.h"
+#include "i2c_host.h"
+#include "rtc_ds1307.h"
+
+/* From rtc_ds1307.c, which only exports them through rtc_ds1307 */
+extern uint8_t rtc_ds1307_read_ram(uint8_t address, uint8_t length,
+                                   unsigned char *data);
+extern uint8_t rtc_ds1307_write_ram(uint8_t address, uint8_t length,
+                                    unsigned char *data);
+
+#define LCD_ADDRESS 0x70
+
+static const i2c_device_t lcd_i2c = I2C_DEVICE(LCD_ADDRESS, 400000UL);
+
+static i2c_host_device_t *rtc;
+static i2c_host_device_t *lcd;
+
+static uint8_t lcd_data[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+static i2c_transaction_t lcd_write;
+
+static int failures;
+
+#define CHECK(condition) \
+  do { \
+    if(!(condition)) \
+    { \
+      printf("  %s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      failures++; \
+    } \
+  } while(0)
+
+/*
+ * Start from power on, with the RTC and LCD on the bus.
+ */
+static void test_setup(const char *name)
+{
+  printf("%s\n", name);
+  fflush(stdout);
+
+  i2c_host_reset();
+  rtc = i2c_host_add_device(RTC_DS1307_I2C_ID);
+  lcd = i2c_host_add_device(LCD_ADDRESS);
+  i2c_init();
+
+  memset(&lcd_write, 0, sizeof(lcd_write));
+  lcd_write.device = &lcd_i2c;
+  lcd_write.write_buffer = lcd_data;
+  lcd_write.write_length = sizeof(lcd_data);
+}
+
+/*
+ * Check that the bus is free, and that a queued write to the LCD (its first
+ * byte selecting the register) then goes through.
+ */
+static void check_queue_runs(void)
+{
+  CHECK(i2c_global.mode == I2C_MODE_IDLE);
+  CHECK(!i2c_global.blocking);
+  CHECK(!i2c_host.owned);
+
+  memset(lcd->registers, 0, sizeof(lcd->registers));
+  CHECK(i2c_submit(&lcd_write) == 0);
+  CHECK(i2c_transaction_wait(&lcd_write) == 0);
+  CHECK(memcmp(lcd->registers, lcd_data + 1, sizeof(lcd_data) - 1) == 0);
+  CHECK(!i2c_host.owned);
+}
+
+/*
+ * An RTC write which fails at its address releases the bus, so that the
+ * queue runs afterwards.
+ */
+static void test_rtc_nak(void)
+{
+  uint8_t data = 0x55;
+
+  test_setup("RTC NAK, then a queued transaction");
+  rtc->nak = 1;
+
+  CHECK(rtc_ds1307_write_ram(0x08, 1, &data) != 0);
+  check_queue_runs();
+
+  rtc->nak = 0;
+  CHECK(rtc_ds1307_write_ram(0x08, 1, &data) == 0);
+  CHECK(rtc->registers[0x08] == 0x55);
+  check_queue_runs();
+}
+
+/*
+ * A caller which fails to start, and then stops anyway, doesn't cut into
+ * the queued transaction which has started meanwhile.
+ */
+static void test_stop_after_failed_start(void)
+{
+  test_setup("i2c_stop() after a failed start");
+  rtc->nak = 1;
+
+  CHECK(i2c_start(RTC_DS1307_I2C_ID, I2C_WRITE) == TW_MT_SLA_NACK);
+  CHECK(i2c_submit(&lcd_write) == 0);
+  i2c_stop();
+  CHECK(i2c_transaction_wait(&lcd_write) == 0);
+  CHECK(i2c_host.starts == i2c_host.stops);
+}
+
+/*
+ * A caller which never stops after a successful start holds the queue up
+ * only until it times out, after which the queue runs again.
+ */
+static void test_leaked_claim(void)
+{
+  i2c_statistics_t statistics;
+
+  test_setup("No i2c_stop() after a successful start");
+
+  CHECK(i2c_device_start(&rtc_ds1307_i2c, I2C_WRITE) == 0);
+  CHECK(i2c_submit(&lcd_write) == 0);
+  CHECK(i2c_transaction_wait(&lcd_write) == I2C_ERROR_TIMEOUT);
+
+  i2c_get_statistics(&statistics);
+  CHECK(statistics.timeouts == 1);
+  CHECK(statistics.recoveries == 1);
+  check_queue_runs();
+}
+
+/*
+ * A bus stuck during a blocking read times out, and is recovered, after
+ * which both blocking and queued transfers work again.
+ */
+static void test_stuck_bus(void)
+{
+  uint8_t data[2];
+  i2c_statistics_t statistics;
+
+  test_setup("Bus stuck during a blocking read");
+  rtc->registers[0] = 0x12;
+  rtc->registers[1] = 0x34;
+  i2c_host.stuck = 1;
+
+  CHECK(rtc_ds1307_read_ram(0x00, 2, data) == I2C_ERROR_TIMEOUT);
+  CHECK(!i2c_host.stuck);
+
+  i2c_get_statistics(&statistics);
+  CHECK(statistics.timeouts >= 1);
+  CHECK(statistics.recoveries == statistics.timeouts);
+  check_queue_runs();
+
+  CHECK(rtc_ds1307_read_ram(0x00, 2, data) == 0);
+  CHECK(data[0] == 0x12 && data[1] == 0x34);
+}
+
+/*
+ * A bus stuck part way through a blocking i2c_write_array() reports the
+ * timeout, rather than the count of bytes left, and is recovered.
+ */
+static void test_stuck_write_array(void)
+{
+  uint8_t data[2] = { 0x08, 0x55 };
+  i2c_statistics_t statistics;
+
+  test_setup("Bus stuck during i2c_write_array()");
+
+  CHECK(i2c_device_start(&rtc_ds1307_i2c, I2C_WRITE) == 0);
+  i2c_host.stuck = 1;
+  CHECK(i2c_write_array(data, sizeof(data)) == I2C_ERROR_TIMEOUT);
+  i2c_stop();
+  CHECK(!i2c_host.stuck);
+
+  i2c_get_statistics(&statistics);
+  CHECK(statistics.timeouts == 1);
+  check_queue_runs();
+
+  CHECK(i2c_device_start(&rtc_ds1307_i2c, I2C_WRITE) == 0);
+  CHECK(i2c_write_array(data, sizeof(data)) == 0);
+  i2c_stop();
+  CHECK(rtc->registers[0x08] == 0x55);
+}
+
+/*
+ * Queued transactions alternating between the LCD (at 400kHz) and the RTC
+ * (at 100kHz) each address their device at its own speed, with the START
+ * before it at the slower speed, and the ISR never waits for a STOP.
+ */
+static void test_speed_change(void)
+{
+  uint8_t rtc_address = 0x08;
+  uint8_t rtc_data;
+  i2c_transaction_t rtc_read;
+  i2c_statistics_t statistics;
+
+  test_setup("Queued transactions at different speeds");
+  rtc->registers[0x08] = 0x42;
+
+  memset(&rtc_read, 0, sizeof(rtc_read));
+  rtc_read.device = &rtc_ds1307_i2c;
+  rtc_read.write_buffer = &rtc_address;
+  rtc_read.write_length = 1;
+  rtc_read.read_buffer = &rtc_data;
+  rtc_read.read_length = 1;
+
+  CHECK(i2c_submit(&lcd_write) == 0);
+  CHECK(i2c_submit(&rtc_read) == 0);
+  CHECK(i2c_transaction_wait(&rtc_read) == 0);
+  CHECK(lcd_write.status == 0);
+  CHECK(rtc_data == 0x42);
+  CHECK(lcd->twbr == lcd_i2c.twbr);
+  CHECK(rtc->twbr == rtc_ds1307_i2c.twbr);
+  CHECK(rtc->start_twbr == rtc_ds1307_i2c.twbr);
+
+  CHECK(i2c_submit(&rtc_read) == 0);
+  CHECK(i2c_submit(&lcd_write) == 0);
+  CHECK(i2c_transaction_wait(&lcd_write) == 0);
+  CHECK(lcd->twbr == lcd_i2c.twbr);
+  CHECK(lcd->start_twbr == rtc_ds1307_i2c.twbr);
+
+  CHECK(i2c_host.isr_stop_waits == 0);
+  /* Each transaction ends with a STOP, and each RTC read turns around */
+  CHECK(i2c_host.stops == 4);
+  CHECK(i2c_host.starts == 4 + 2);
+  i2c_get_statistics(&statistics);
+  CHECK(statistics.timeouts == 0);
+  CHECK(!i2c_host.owned);
+}
+
+#define SLAVE_ADDRESS 0x60
+
+static uint8_t registers_a[8] =
+  { 0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7 };
+static uint8_t registers_b[8] =
+  { 0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7 };
+static i2c_registers_t registers;
+
+/*
+ * Serve registers_a as the register file, with registers_b behind it.
+ */
+static void registers_setup(const char *name)
+{
+  test_setup(name);
+  i2c_slave_init(SLAVE_ADDRESS, 0, 0);
+  i2c_slave_registers(&registers, registers_a, registers_b,
+                      sizeof(registers_a));
+}
+
+/*
+ * Have the other master write the register pointer, ending with a STOP.
+ */
+static void registers_select(uint8_t pointer)
+{
+  i2c_host_slave(TW_SR_SLA_ACK, SLAVE_ADDRESS);
+  i2c_host_slave(TW_SR_DATA_ACK, pointer);
+  i2c_host_slave(TW_SR_STOP, 0);
+}
+
+/*
+ * A read of the register file starts from the register selected, and
+ * wraps at the end; a register past the end selects the first.
+ */
+static void test_registers_wrap(void)
+{
+  registers_setup("Register file read, wrapping at the end");
+
+  registers_select(6);
+  CHECK(i2c_host_slave(TW_ST_SLA_ACK, 0) == 0xa6);
+  CHECK(i2c_host_slave(TW_ST_DATA_ACK, 0) == 0xa7);
+  CHECK(i2c_host_slave(TW_ST_DATA_ACK, 0) == 0xa0);
+  CHECK(i2c_host_slave(TW_ST_DATA_ACK, 0) == 0xa1);
+  i2c_host_slave(TW_ST_DATA_NACK, 0);
+  CHECK(registers.pointer == 2);
+
+  registers_select(sizeof(registers_a));
+  CHECK(i2c_host_slave(TW_ST_SLA_ACK, 0) == 0xa0);
+  i2c_host_slave(TW_ST_DATA_NACK, 0);
+
+  check_queue_runs();
+}
+
+/*
+ * A buffer published while no read is in progress is served at once, and
+ * the old front buffer becomes the back.
+ */
+static void test_registers_publish(void)
+{
+  registers_setup("Register file published between reads");
+
+  CHECK(i2c_registers_back(&registers) == registers_b);
+  i2c_registers_publish(&registers);
+  CHECK(i2c_registers_back(&registers) == registers_a);
+
+  registers_select(0);
+  CHECK(i2c_host_slave(TW_ST_SLA_ACK, 0) == 0xb0);
+  i2c_host_slave(TW_ST_DATA_NACK, 0);
+}
+
+/*
+ * A buffer published during a read isn't served until the read ends with
+ * a NAK, so that the read is consistent, and there is no back buffer to
+ * fill until then.
+ */
+static void test_registers_publish_during_read(void)
+{
+  registers_setup("Register file published during a read");
+
+  registers_select(0);
+  CHECK(i2c_host_slave(TW_ST_SLA_ACK, 0) == 0xa0);
+
+  i2c_registers_publish(&registers);
+  CHECK(registers.pending);
+  CHECK(i2c_registers_back(&registers) == NULL);
+
+  CHECK(i2c_host_slave(TW_ST_DATA_ACK, 0) == 0xa1);
+  CHECK(i2c_host_slave(TW_ST_DATA_ACK, 0) == 0xa2);
+  CHECK(i2c_registers_back(&registers) == NULL);
+
+  i2c_host_slave(TW_ST_DATA_NACK, 0);
+  CHECK(!registers.pending);
+  CHECK(i2c_registers_back(&registers) == registers_a);
+
+  registers_select(1);
+  CHECK(i2c_host_slave(TW_ST_SLA_ACK, 0) == 0xb1);
+  i2c_host_slave(TW_ST_DATA_NACK, 0);
+
+  check_queue_runs();
+}
+
+static uint8_t slave_rx[4];
+static uint8_t slave_tx[4] = { 0x10, 0x11, 0x12, 0x13 };
+static i2c_slave_buffers_t slave_buffers;
+
+/* The callbacks from the buffer slave, and the last one's arguments */
+static int slave_calls;
+static i2c_mode_t slave_mode;
+static uint8_t slave_count;
+static uint8_t slave_status;
+
+static void slave_callback(i2c_mode_t mode, uint8_t count, uint8_t status)
+{
+  slave_calls++;
+  slave_mode = mode;
+  slave_count = count;
+  slave_status = status;
+}
+
+/*
+ * Serve transfers from slave_rx and the first tx_length bytes of slave_tx.
+ */
+static void slave_buffers_setup(const char *name, uint8_t tx_length)
+{
+  test_setup(name);
+  memset(slave_rx, 0, sizeof(slave_rx));
+  slave_calls = 0;
+  i2c_slave_init(SLAVE_ADDRESS, 0, 0);
+  i2c_slave_buffers(&slave_buffers, slave_rx, sizeof(slave_rx),
+                    slave_tx, tx_length, slave_callback);
+}
+
+/*
+ * Check that the buffer slave has called back calls times in all, the last
+ * time with the mode, count, and status given.
+ */
+#define CHECK_SLAVE_CALLBACK(calls, mode, count, status) \
+  do { \
+    CHECK(slave_calls == (calls)); \
+    CHECK(slave_mode == (mode)); \
+    CHECK(slave_count == (count)); \
+    CHECK(slave_status == (status)); \
+  } while(0)
+
+/*
+ * A write is received into the buffer, with one callback at the STOP,
+ * giving the count received.
+ */
+static void test_slave_write(void)
+{
+  slave_buffers_setup("Buffer slave write", sizeof(slave_tx));
+
+  i2c_host_slave(TW_SR_SLA_ACK, SLAVE_ADDRESS);
+  i2c_host_slave(TW_SR_DATA_ACK, 0x21);
+  i2c_host_slave(TW_SR_DATA_ACK, 0x22);
+  i2c_host_slave(TW_SR_DATA_ACK, 0x23);
+  CHECK(slave_calls == 0);
+  i2c_host_slave(TW_SR_STOP, 0);
+
+  CHECK_SLAVE_CALLBACK(1, I2C_MODE_SR, 3, 0);
+  CHECK(slave_rx[0] == 0x21 && slave_rx[1] == 0x22 && slave_rx[2] == 0x23);
+  check_queue_runs();
+  CHECK(slave_calls == 1);
+}
+
+/*
+ * A write ended by a repeated START for a read calls back for each, once
+ * the write is over and once the read is.
+ */
+static void test_slave_write_then_read(void)
+{
+  slave_buffers_setup("Buffer slave write, then read after repeated START",
+                      sizeof(slave_tx));
+
+  i2c_host_slave(TW_SR_SLA_ACK, SLAVE_ADDRESS);
+  i2c_host_slave(TW_SR_DATA_ACK, 0x31);
+  /* The status is the same for a repeated START as for a STOP */
+  i2c_host_slave(TW_SR_STOP, 0);
+  CHECK_SLAVE_CALLBACK(1, I2C_MODE_SR, 1, 0);
+
+  CHECK(i2c_host_slave(TW_ST_SLA_ACK, 0) == 0x10);
+  CHECK(i2c_host_slave(TW_ST_DATA_ACK, 0) == 0x11);
+  CHECK(i2c_host_slave(TW_ST_DATA_ACK, 0) == 0x12);
+  CHECK(i2c_host_slave(TW_ST_DATA_ACK, 0) == 0x13);
+  CHECK(slave_calls == 1);
+  i2c_host_slave(TW_ST_DATA_NACK, 0);
+  CHECK_SLAVE_CALLBACK(2, I2C_MODE_ST, 4, 0);
+
+  check_queue_runs();
+  CHECK(slave_calls == 2);
+}
+
+/*
+ * Writing more than the receive buffer holds, or reading past the bytes to
+ * send, is flagged with I2C_SLAVE_OVERFLOW, and 0xff is sent.
+ */
+static void test_slave_overflow(void)
+{
+  uint8_t i;
+
+  slave_buffers_setup("Buffer slave overflow", 2);
+
+  i2c_host_slave(TW_SR_SLA_ACK, SLAVE_ADDRESS);
+  for(i = 0; i < sizeof(slave_rx) + 2; i++)
+    i2c_host_slave(TW_SR_DATA_ACK, 0x40 + i);
+  i2c_host_slave(TW_SR_STOP, 0);
+  CHECK_SLAVE_CALLBACK(1, I2C_MODE_SR, sizeof(slave_rx), I2C_SLAVE_OVERFLOW);
+  CHECK(slave_rx[sizeof(slave_rx) - 1] == 0x40 + sizeof(slave_rx) - 1);
+
+  CHECK(i2c_host_slave(TW_ST_SLA_ACK, 0) == 0x10);
+  CHECK(i2c_host_slave(TW_ST_DATA_ACK, 0) == 0x11);
+  CHECK(i2c_host_slave(TW_ST_DATA_ACK, 0) == 0xff);
+  i2c_host_slave(TW_ST_DATA_NACK, 0);
+  CHECK_SLAVE_CALLBACK(2, I2C_MODE_ST, 3, I2C_SLAVE_OVERFLOW);
+
+  /* Each transfer starts afresh */
+  i2c_host_slave(TW_SR_SLA_ACK, SLAVE_ADDRESS);
+  i2c_host_slave(TW_SR_DATA_ACK, 0x50);
+  i2c_host_slave(TW_SR_STOP, 0);
+  CHECK_SLAVE_CALLBACK(3, I2C_MODE_SR, 1, 0);
+}
+
+/*
+ * A read which the master ends with a NAK before the end of the bytes to
+ * send is flagged with I2C_SLAVE_NAK.
+ */
+static void test_slave_early_nak(void)
+{
+  slave_buffers_setup("Buffer slave read ended early", sizeof(slave_tx));
+
+  CHECK(i2c_host_slave(TW_ST_SLA_ACK, 0) == 0x10);
+  CHECK(i2c_host_slave(TW_ST_DATA_ACK, 0) == 0x11);
+  i2c_host_slave(TW_ST_DATA_NACK, 0);
+  CHECK_SLAVE_CALLBACK(1, I2C_MODE_ST, 2, I2C_SLAVE_NAK);
+
+  check_queue_runs();
+  CHECK(slave_calls == 1);
+}
+
+#if I2C_TRACE
+/*
+ * The counters the decoder printed for address, from its output.
+ */
+typedef struct _decoded_address_t
+{
+  unsigned int transactions;
+  unsigned int naks;
+  unsigned int timeouts;
+} decoded_address_t;
+
+/*
+ * Run i2c_trace_decode.py over the capture in path, returning the number of
+ * entries it decoded (or -1 if it found no dump), and the counters for the
+ * RTC and LCD in rtc_decoded and lcd_decoded.
+ */
+static int trace_decode(const char *path, decoded_address_t *rtc_decoded,
+                        decoded_address_t *lcd_decoded)
+{
+  char command[256], line[256];
+  unsigned int address, transactions, naks, arbitration, timeouts;
+  int entries = -1;
+  FILE *decoder;
+
+  snprintf(command, sizeof(command), "python3 %s %s", I2C_TRACE_DECODE, path);
+  decoder = popen(command, "r");
+  if(!decoder)
+    return -1;
+
+  while(fgets(line, sizeof(line), decoder))
+  {
+    if(sscanf(line, "I2C trace: %d entries", &entries) == 1)
+      continue;
+    if(sscanf(line, " 0x%x %u %u %u %u", &address,
+              &transactions, &naks, &arbitration, &timeouts) != 5)
+      continue;
+    if(address == RTC_DS1307_I2C_ID)
+      *rtc_decoded = (decoded_address_t){ transactions, naks, timeouts };
+    else if(address == LCD_ADDRESS)
+      *lcd_decoded = (decoded_address_t){ transactions, naks, timeouts };
+  }
+
+  pclose(decoder);
+  return entries;
+}
+
+/*
+ * A trace of an RTC write which is NAKed, a blocking RTC read on a stuck
+ * bus, and a queued LCD write, dumped to memory, is well formed, and is
+ * decoded by i2c_trace_decode.py (from among other console output) with
+ * every entry, and the NAK and timeout counted against the RTC.
+ */
+static void test_trace_decode(void)
+{
+  uint8_t data = 0x55;
+  uint8_t count, checksum = 0;
+  char *dump;
+  size_t length, i;
+  FILE *stream;
+  char path[] = "/tmp/i2c_trace_XXXXXX";
+  int fd;
+  decoded_address_t rtc_decoded = { 0, 0, 0 }, lcd_decoded = { 0, 0, 0 };
+
+  test_setup("Trace dump decoded by i2c_trace_decode.py");
+
+  rtc->nak = 1;
+  CHECK(rtc_ds1307_write_ram(0x08, 1, &data) != 0);
+  rtc->nak = 0;
+  i2c_host.stuck = 1;
+  CHECK(rtc_ds1307_read_ram(0x00, 1, &data) == I2C_ERROR_TIMEOUT);
+  check_queue_runs();
+
+  count = i2c_trace.count;
+  stream = open_memstream(&dump, &length);
+  i2c_trace_dump(stream);
+  fclose(stream);
+
+  /* Magic, version, counter rate, dropped count, then the entry count */
+  CHECK(length > 11 && memcmp(dump, I2C_TRACE_MAGIC, 4) == 0);
+  CHECK((uint8_t)dump[11] == count);
+  for(i = 4; i < length; i++)
+    checksum ^= dump[i];
+  CHECK(checksum == 0);
+
+  fd = mkstemp(path);
+  CHECK(fd >= 0);
+  stream = fdopen(fd, "w");
+  fputs("Booted!\n", stream);
+  fwrite(dump, 1, length, stream);
+  fputs("\nDone.\n", stream);
+  fclose(stream);
+  free(dump);
+
+  CHECK(trace_decode(path, &rtc_decoded, &lcd_decoded) == count);
+  unlink(path);
+
+  CHECK(rtc_decoded.transactions == 2);
+  CHECK(rtc_decoded.naks == 1);
+  CHECK(rtc_decoded.timeouts == 1);
+  CHECK(lcd_decoded.transactions == 1);
+  CHECK(lcd_decoded.naks == 0 && lcd_decoded.timeouts == 0);
+}
+#endif
+
+int main(void)
+{
+  /* A queue which never runs again hangs, rather than failing a check */
+  alarm(10);
+
+  test_rtc_nak();
+  test_stop_after_failed_start();
+  test_leaked_claim();
+  test_stuck_bus();
+  test_stuck_write_array();
+  test_speed_change();
+  test_registers_wrap();
+  test_registers_publish();
+  test_registers_publish_during_read();
+  test_slave_write();
+  test_slave_write_then_read();
+  test_slave_overflow();
+  test_slave_early_nak();
+#if I2C_TRACE
+  test_trace_decode();
+#endif
+
+  printf(failures ? "%d checks failed\n" : "All tests passed\n", failures);
+
+  return failures ? 1 : 0;
+}
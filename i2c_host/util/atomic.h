@@ -0,0 +1,34 @@
+/*
+    Copyright (c) 2010, Jeremy Cole <jeremy@jcole.us>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Host stand-in for avr-libc's <util/atomic.h>.  As the simulated ISR only
+ * runs from i2c_host_run(), every block is already atomic.
+ */
+
+#ifndef I2C_HOST_UTIL_ATOMIC_H
+#define I2C_HOST_UTIL_ATOMIC_H
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+
+#define ATOMIC_BLOCK(type) \
+  for(uint8_t i2c_host_atomic = 1; i2c_host_atomic; i2c_host_atomic = 0)
+
+#endif /* I2C_HOST_UTIL_ATOMIC_H */
@@ -0,0 +1,69 @@
+/*
+    Copyright (c) 2010, Jeremy Cole <jeremy@jcole.us>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Host stand-in for avr-libc's <util/twi.h>, with the TWI status codes.
+ */
+
+#ifndef I2C_HOST_UTIL_TWI_H
+#define I2C_HOST_UTIL_TWI_H
+
+#include <avr/io.h>
+
+#define TW_STATUS_MASK            0xF8
+#define TW_STATUS                 (TWSR & TW_STATUS_MASK)
+
+#define TW_START                  0x08
+#define TW_REP_START              0x10
+
+#define TW_MT_SLA_ACK             0x18
+#define TW_MT_SLA_NACK            0x20
+#define TW_MT_DATA_ACK            0x28
+#define TW_MT_DATA_NACK           0x30
+#define TW_MT_ARB_LOST            0x38
+
+#define TW_MR_ARB_LOST            0x38
+#define TW_MR_SLA_ACK             0x40
+#define TW_MR_SLA_NACK            0x48
+#define TW_MR_DATA_ACK            0x50
+#define TW_MR_DATA_NACK           0x58
+
+#define TW_ST_SLA_ACK             0xA8
+#define TW_ST_ARB_LOST_SLA_ACK    0xB0
+#define TW_ST_DATA_ACK            0xB8
+#define TW_ST_DATA_NACK           0xC0
+#define TW_ST_LAST_DATA           0xC8
+
+#define TW_SR_SLA_ACK             0x60
+#define TW_SR_ARB_LOST_SLA_ACK    0x68
+#define TW_SR_GCALL_ACK           0x70
+#define TW_SR_ARB_LOST_GCALL_ACK  0x78
+#define TW_SR_DATA_ACK            0x80
+#define TW_SR_DATA_NACK           0x88
+#define TW_SR_GCALL_DATA_ACK      0x90
+#define TW_SR_GCALL_DATA_NACK     0x98
+#define TW_SR_STOP                0xA0
+
+#define TW_NO_INFO                0xF8
+#define TW_BUS_ERROR              0x00
+
+#define TW_READ                   1
+#define TW_WRITE                  0
+
+#endif /* I2C_HOST_UTIL_TWI_H */
@@ -36,7 +36,7 @@ int main(void)
 
   _delay_ms(1000);
 
-  u0 = uart_init("0", 0);
+  u0 = uart_init_ubrr("0", 0);
   uart_init_stdout(u0);
 
   i2c_init();
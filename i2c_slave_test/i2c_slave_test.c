@@ -30,21 +30,14 @@
 #include <i2c.h>
 
 uint8_t i2c_data[16];
-uint8_t data_offset;
+i2c_slave_buffers_t i2c_buffers;
+volatile uint8_t i2c_count;
+volatile uint8_t i2c_status;
 
-uint8_t handle_sr(uint8_t status, i2c_mode_t last_mode, i2c_mode_t current_mode)
+void handle_slave(i2c_mode_t mode, uint8_t count, uint8_t status)
 {
-  if(last_mode != current_mode)
-  {
-    data_offset=0;
-    memset(i2c_data, 0, 16);
-  }
-
-  if(status == TW_SR_DATA_ACK || status == TW_SR_DATA_NACK)
-    i2c_data[data_offset++] = TWDR;
-
-  TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWEA);
-  return 0;
+  i2c_count = count;
+  i2c_status = status;
 }
 
 int main(void)
@@ -53,12 +46,13 @@ int main(void)
 
   _delay_ms(1000);
 
-  u0 = uart_init("0", 0);
+  u0 = uart_init_ubrr("0", 0);
   uart_init_stdout(u0);
 
   i2c_init();
   i2c_slave_init(0x70, 0, 0);
-  i2c_global.sr_callback = handle_sr;
+  i2c_slave_buffers(&i2c_buffers, i2c_data, sizeof(i2c_data),
+      i2c_data, sizeof(i2c_data), handle_slave);
 
   sei();
 
@@ -66,7 +60,8 @@ int main(void)
 
   while(1)
   {
-    printf("I2C Mode: %i, Data: %i, %i, %i\n", i2c_global.mode,
+    printf("I2C Mode: %i, Count: %i, Status: %i, Data: %i, %i, %i\n",
+        i2c_global.mode, i2c_count, i2c_status,
         i2c_data[0], i2c_data[1], i2c_data[2]);
 
     _delay_ms(1000);
@@ -75,9 +75,12 @@ struct {
   rtc_datetime_24h_t current_dt;
   uint8_t gps_signal_strength;
 } data;
-uint8_t *data_p;
 uint8_t data_age = MAX_DATA_AGE_CS;
 
+/* Received by the I2C ISR, and copied to data once complete */
+uint8_t i2c_rx_buffer[sizeof(data)];
+i2c_slave_buffers_t i2c_buffers;
+
 #define CG_GPS_ICON 0
 lcd_cg_t cg_gps_icon = {
   0b00000000,
@@ -185,19 +188,17 @@ lcd_cg_t cg_gps_signal[9] = {
   },
 };
 
-uint8_t handle_i2c_slave_rx(uint8_t status, i2c_mode_t last_mode, i2c_mode_t current_mode)
+/*
+ * Called at the end of each write from the master.  Only a complete
+ * update is displayed, so a short or overlong write is ignored.
+ */
+void handle_i2c_slave_rx(i2c_mode_t mode, uint8_t count, uint8_t status)
 {
-  if(last_mode != current_mode)
-  {
-    data_p = (uint8_t *)&data;
-  }
-
-  if(status == TW_SR_DATA_ACK || status == TW_SR_DATA_NACK)
-    *data_p++ = TWDR;
+  if(mode != I2C_MODE_SR || count != sizeof(data) || status)
+    return;
 
+  memcpy(&data, i2c_rx_buffer, sizeof(data));
   data_age = 0;
-
-  return 0;
 }
 
 int main(void)
@@ -207,12 +208,13 @@ int main(void)
 
   _delay_ms(1000);
 
-  u0 = uart_init("0", UART_BAUD_SELECT(38400, F_CPU));
+  u0 = uart_init("0", 38400);
   uart_init_stdout(u0);
 
   i2c_init();
   i2c_slave_init(0x70, I2C_ADDRESS_MASK_SINGLE, I2C_GCALL_DISABLED);
-  i2c_global.sr_callback = handle_i2c_slave_rx;
+  i2c_slave_buffers(&i2c_buffers, i2c_rx_buffer, sizeof(i2c_rx_buffer),
+      NULL, 0, handle_i2c_slave_rx);
 
   DDRB |= _BV(PB3) | _BV(PB4);
 
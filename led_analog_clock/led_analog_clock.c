@@ -27,12 +27,12 @@
 #include <avr/pgmspace.h>
 #include <avr/eeprom.h>
 
-#define I2C_SCL_CLOCK 400000L
 #include <i2c.h>
 
 #include <rtc.h>
 #include <rtc_ds1307.h>
 #include <uart.h>
+#include <uart_log.h>
 #include <led_sequencer.h>
 #include <led_charlieplex.h>
 
@@ -72,6 +72,9 @@ rtc_dst_date_t usa_dst_dates[] =
   {0, 0, 0, 0, 0}
 };
 
+/* Deferred log messages from the clock update and GPS sync, see uart_log.h */
+unsigned char log_buffer[128];
+
 uint8_t last_hour   = 0;
 uint8_t last_minute = 0;
 uint8_t last_second = 0;
@@ -81,12 +84,29 @@ struct {
   uint8_t gps_signal_strength;
 } gps_data;
 
+/* Queued I2C reads from the RTC and GPS, and writes to the remote LCD */
+uint8_t rtc_register = 0x00;
+rtc_ds1307_clock_raw_t rtc_raw;
+i2c_transaction_t rtc_transaction;
+
+const i2c_device_t gps_i2c = I2C_DEVICE(0x60, 400000UL);
+const i2c_device_t remote_lcd_i2c = I2C_DEVICE(0x70, 400000UL);
+
+uint8_t gps_register = 0x00;
+uint8_t gps_buffer[sizeof(gps_data)];
+i2c_transaction_t gps_transaction;
+
+uint8_t remote_lcd_buffer[sizeof(rtc_datetime_24h_t) + 1];
+i2c_transaction_t remote_lcd_transaction;
+
 uint16_t time_elapsed_since_gps_sync = 0;
 
 volatile uint8_t ready_flags = 0;
 
 #define READY_UART_DATA  1
 #define READY_UPDATE_HMS 2
+#define READY_GPS_DATA   4
+#define READY_RTC_DATA   8
 
 /**
  * Pin change interrupt attached to SQW (square wave) output pin from DS1307.
@@ -115,19 +135,46 @@ void notice_uart_input(uart_t *uart)
   ready_flags |= READY_UART_DATA;
 }
 
+/**
+ * Callback for completion of the queued RTC read.  Don't do anything with
+ * the time just yet, but mark that it's ready to be handled outside of the
+ * interrupt handler.
+ */
+void notice_rtc_data(i2c_transaction_t *transaction)
+{
+  ready_flags |= READY_RTC_DATA;
+}
+
+/**
+ * Callback for completion of the queued GPS read.  Don't do anything with
+ * the data just yet, but mark that it's ready to be handled outside of the
+ * interrupt handler.
+ */
+void notice_gps_data(i2c_transaction_t *transaction)
+{
+  ready_flags |= READY_GPS_DATA;
+}
+
 /**
  * Write the current time (in rtc_datetime_24h_t format) to a remote LCD
  * device over I2C. This is essentially fire-and-forget, as there's no check
- * that the remote device exists or received the data correctly.
+ * that the remote device exists or received the data correctly.  If the
+ * previous write hasn't completed yet, this one is skipped.
  */
 void write_remote_lcd(rtc_datetime_24h_t *dt, uint8_t gps_signal_strength)
 {
-  if(0 == i2c_start(0x70, I2C_WRITE))
-  {
-    i2c_write_array((uint8_t *)dt, sizeof(*dt));
-  }
-  i2c_write(gps_signal_strength);
-  i2c_stop();
+  if(remote_lcd_transaction.status == I2C_PENDING)
+    return;
+
+  memcpy(remote_lcd_buffer, dt, sizeof(*dt));
+  remote_lcd_buffer[sizeof(*dt)] = gps_signal_strength;
+
+  remote_lcd_transaction.device = &remote_lcd_i2c;
+  remote_lcd_transaction.write_buffer = remote_lcd_buffer;
+  remote_lcd_transaction.write_length = sizeof(remote_lcd_buffer);
+  remote_lcd_transaction.read_length = 0;
+  remote_lcd_transaction.callback = NULL;
+  i2c_submit(&remote_lcd_transaction);
 }
 
 uint8_t jit_qhour_loop_25ms(led_sequence_step_t *step, uint8_t status)
@@ -355,41 +402,55 @@ void command_offset(char *command)
   configuration_save();
 }
 
-uint8_t gps_read_ram(uint8_t address, uint8_t length, unsigned char *data)
+/**
+ * Queue a read of the current time and signal strength from the GPS, to be
+ * picked up by handle_gps_data() once complete.  If the previous read is
+ * still in progress, nothing more is queued.
+ */
+void update_gps_async()
 {
-  uint8_t rc;
-  uint8_t pos;
+  if(gps_transaction.status == I2C_PENDING)
+    return;
 
-  /*
-  rc = i2c_start(0x60, I2C_WRITE);
-  if(rc) return 1;
+  gps_transaction.device = &gps_i2c;
+  gps_transaction.write_buffer = &gps_register;
+  gps_transaction.write_length = 1;
+  gps_transaction.read_buffer = gps_buffer;
+  gps_transaction.read_length = sizeof(gps_buffer);
+  gps_transaction.callback = notice_gps_data;
+  i2c_submit(&gps_transaction);
+}
 
-  rc = i2c_write(address);
-  if(rc) return 2;
+/**
+ * Handle a completed GPS read, copying the data into gps_data if it was
+ * successful.
+ */
+uint8_t handle_gps_data()
+{
+  uint8_t rc = gps_transaction.status;
 
-  i2c_stop();
-  */
-  rc = i2c_rep_start(0x60, I2C_READ);
-  if(rc) return rc;
+  ready_flags &= ~READY_GPS_DATA;
 
-  for(pos=0; pos < length; pos++, data++)
+  if(rc)
   {
-    *data = (char)i2c_read(pos != (length-1));
+    UART_LOG("Return from GPS read: 0x%02x\n", rc);
+    return rc;
   }
-  i2c_stop();
 
+  memcpy(&gps_data, gps_buffer, sizeof(gps_data));
   return 0;
 }
 
+/**
+ * Read the current time and signal strength from the GPS, waiting for the
+ * read to complete.
+ */
 uint8_t update_gps()
 {
-  uint8_t rc;
-  rc = gps_read_ram(0, sizeof(gps_data), (unsigned char *)&gps_data);
-  if(rc)
-  {
-    printf("Return from gps_read_ram: %d\n", rc);
-  }
-  return rc;
+  update_gps_async();
+  i2c_transaction_wait(&gps_transaction);
+
+  return handle_gps_data();
 }
 
 void command_get_gps()
@@ -451,7 +512,23 @@ void wait_ms(uint16_t milliseconds)
   }
 }
 
-void command_set_from_gps(void)
+/*
+ * Report the progress of a GPS sync as text on the console when it was asked
+ * for interactively, or as deferred log frames from update_hms_async(),
+ * which mustn't wait on the UART.
+ */
+#define SYNC_REPORT(interactive, format, ...) \
+  do { \
+    if(interactive) \
+      printf_P(PSTR(format), ##__VA_ARGS__); \
+    else \
+      UART_LOG(format, ##__VA_ARGS__); \
+  } while(0)
+
+/**
+ * Set the RTC from the GPS, waiting for the edge of the next second.
+ */
+void sync_from_gps(uint8_t interactive)
 {
   uint8_t rc;
 
@@ -460,7 +537,8 @@ void command_set_from_gps(void)
 
   if(gps_data.gps_signal_strength < 3)
   {
-    printf_P(PSTR("GPS signal strength (%d) is unreliable. Aborting sync!\n"),
+    SYNC_REPORT(interactive,
+        "GPS signal strength (%d) is unreliable. Aborting sync!\n",
         gps_data.gps_signal_strength);
     return;
   }
@@ -468,7 +546,7 @@ void command_set_from_gps(void)
   if(gps_data.dt.second < (59 - gps_leap_second_offset))
   {
     /* Adjust to the edge of the next second, don't deal with rollover */
-    printf_P(PSTR("Sleeping for %d ms to synchronize...\n"),
+    SYNC_REPORT(interactive, "Sleeping for %d ms to synchronize...\n",
         1000 - gps_data.dt.millisecond - 1);
     wait_ms(1000 - gps_data.dt.millisecond - 1);
     gps_data.dt.second += 1 + gps_leap_second_offset;
@@ -476,22 +554,34 @@ void command_set_from_gps(void)
   }
 
   rc = rtc_clock_stop(rtc);
-  printf_P(PSTR("Halted clock, rc=%i\n"), rc);
+  SYNC_REPORT(interactive, "Halted clock, rc=%i\n", rc);
 
   rtc_sqw_enable(rtc);
   rtc_sqw_rate(rtc, 1);
 
-  printf_P(PSTR("Setting time to %04i-%02i-%02i %02i:%02i:%02i (%s)\n"),
-      gps_data.dt.year, gps_data.dt.month, gps_data.dt.date,
-      gps_data.dt.hour, gps_data.dt.minute, gps_data.dt.second,
-      rtc_dow_names[gps_data.dt.day_of_week]);
-
-  printf_P(PSTR("Trying to write RTC...\n"));
+  /* The day's name is in RAM, which can't be logged */
+  if(interactive)
+    printf_P(PSTR("Setting time to %04i-%02i-%02i %02i:%02i:%02i (%s)\n"),
+        gps_data.dt.year, gps_data.dt.month, gps_data.dt.date,
+        gps_data.dt.hour, gps_data.dt.minute, gps_data.dt.second,
+        rtc_dow_names[gps_data.dt.day_of_week]);
+  else
+    UART_LOG("Setting time to %04i-%02i-%02i %02i:%02i:%02i (day %i)\n",
+        gps_data.dt.year, gps_data.dt.month, gps_data.dt.date,
+        gps_data.dt.hour, gps_data.dt.minute, gps_data.dt.second,
+        gps_data.dt.day_of_week);
+
+  SYNC_REPORT(interactive, "Trying to write RTC...\n");
   rc = rtc_write(rtc, &gps_data.dt);
-  printf_P(PSTR("Wrote RTC, rc=%i\n"), rc);
+  SYNC_REPORT(interactive, "Wrote RTC, rc=%i\n", rc);
 
   rc = rtc_clock_start(rtc);
-  printf_P(PSTR("Started clock, rc=%i\n"), rc);
+  SYNC_REPORT(interactive, "Started clock, rc=%i\n", rc);
+}
+
+void command_set_from_gps(void)
+{
+  sync_from_gps(1);
 }
 
 /**
@@ -507,6 +597,38 @@ void command_eeprom_dump()
   printf("\n");
 }
 
+/**
+ * Print the I2C master counters, to see how often the bus has failed or
+ * hung, and the longest any transaction has waited on it.
+ */
+void command_i2c_statistics()
+{
+  i2c_statistics_t statistics;
+
+  i2c_get_statistics(&statistics);
+  printf_P(PSTR("I2C  : %u transactions, %u failed, %u timeouts, "
+                "%u recoveries, max wait %u us\n"),
+    statistics.transactions, statistics.failures, statistics.timeouts,
+    statistics.recoveries, statistics.max_wait_us);
+}
+
+#if I2C_TRACE
+/**
+ * Dump the I2C trace in binary, to be decoded by i2c/i2c_trace_decode.py.
+ * It's written through a raw stream on the console's UART, as stdout would
+ * send each 0x0A byte in it as "\r\n".
+ */
+void command_i2c_trace()
+{
+  uart_stream_t raw;
+  FILE *stream;
+
+  uart_stream_flush(stdout);
+  stream = uart_stream_init(&raw, uart_stdout.uart, 0);
+  i2c_trace_dump(stream);
+}
+#endif
+
 /**
  * Dispatch a command to its handling function based on the single-letter
  * command.
@@ -546,6 +668,14 @@ void handle_command(char *command)
   case 'g':
     command_get_gps();
     break;
+  case 'i':
+    command_i2c_statistics();
+    break;
+#if I2C_TRACE
+  case 'T':
+    command_i2c_trace();
+    break;
+#endif
   default:
     break;
   }
@@ -558,13 +688,19 @@ void handle_command(char *command)
 void handle_uart_input(uart_t *uart)
 {
   static char command_buffer[COMMAND_BUFFER_SIZE] = "";
+  unsigned int data;
   char c, *s;
 
-  c = uart_getc(uart);
+  data = uart_getc(uart);
 
-  if(c & UART_NO_DATA)
+  if(data & UART_NO_DATA)
     return;
 
+  /* Echo after anything still buffered on stdout, such as a prompt */
+  uart_stream_flush(stdout);
+
+  c = data;
+
   if(c == 0x03) /* Control-C */
   {
     uart_putc(uart, '\r');
@@ -607,11 +743,41 @@ void handle_uart_input(uart_t *uart)
   command_buffer[0] = 0;
 }
 
+/**
+ * Queue a read of the current time from the RTC, to be picked up by
+ * update_hms() once complete, so that the main loop isn't held up for the
+ * read at the DS1307's 100 kHz.  This function is called once per second
+ * during the main loop after the interrupt triggered by the time change
+ * marks READY_UPDATE_HMS.  If it has been too long since the last GPS sync,
+ * the RTC is set from the GPS first.  If the previous read is still in
+ * progress, nothing more is queued.
+ */
+void update_hms_async(void)
+{
+  if(++time_elapsed_since_gps_sync > 1777)
+  {
+    UART_LOG("Maximum time limit exceeded since last GPS sync, syncing...\n");
+    sync_from_gps(0);
+    time_elapsed_since_gps_sync = 0;
+  }
+
+  if(rtc_transaction.status == I2C_PENDING)
+    return;
+
+  rtc_transaction.device = &rtc_ds1307_i2c;
+  rtc_transaction.write_buffer = &rtc_register;
+  rtc_transaction.write_length = 1;
+  rtc_transaction.read_buffer = (uint8_t *)&rtc_raw;
+  rtc_transaction.read_length = sizeof(rtc_raw);
+  rtc_transaction.callback = notice_rtc_data;
+  i2c_submit(&rtc_transaction);
+}
+
 /**
  * Update the "h", "m", and "s" sequences, optionally queuing an animation
  * into "H" or "M" sequences, depending on the new time.  This function is
- * called once per second during the main loop after the interrupt triggered
- * by the time change marks update_hms_ready.
+ * called during the main loop once the RTC read queued by update_hms_async()
+ * has completed.
  *
  * The "h", "m", and "s" sequences are updated in-place in order to avoid
  * additional work and possible memory fragmentation from removing and
@@ -622,14 +788,16 @@ void update_hms(void)
   uint8_t rc;
   rtc_datetime_24h_t offset_time;
 
-  if(++time_elapsed_since_gps_sync > 1777)
+  ready_flags &= ~READY_RTC_DATA;
+
+  rc = rtc_transaction.status;
+  if(rc)
   {
-    printf_P(PSTR("Maximum time limit exceeded since last GPS sync, syncing...\n"));
-    command_set_from_gps();
-    time_elapsed_since_gps_sync = 0;
+    UART_LOG("Return from RTC read: 0x%02x\n", rc);
+    return;
   }
 
-  rc = rtc_read(rtc, &current_time);
+  rc = rtc_ds1307_decode_clock_raw(&rtc_raw, &current_time);
   if(rc) return;
 
   rtc_offset_time(&current_time, &offset_time,
@@ -688,7 +856,7 @@ void update_hms(void)
   }
 
   led_sequencer_run();
-  update_gps();
+  update_gps_async();
   write_remote_lcd(&offset_time, gps_data.gps_signal_strength);
 }
 
@@ -700,9 +868,12 @@ int main(void)
   _delay_ms(1000);
 
   /* Initialize USART0 and set up stdout to write to it. */
-  u0 = uart_init("0", UART_BAUD_SELECT(38400, F_CPU));
+  u0 = uart_init("0", 38400);
   uart_init_stdout(u0);
   uart_set_rx_callback(u0, notice_uart_input);
+  /* Only wake up as input starts arriving, not for every byte. */
+  uart_set_rx_threshold(u0, 1);
+  uart_log_init(log_buffer, sizeof(log_buffer));
 
   i2c_init();
 
@@ -796,20 +967,36 @@ int main(void)
    */
   while(1)
   {
-    /* Handle UART input when ready. */
+    /* Handle all UART input received when ready. */
     if(ready_flags & READY_UART_DATA)
     {
       ready_flags &= ~READY_UART_DATA;
-      handle_uart_input(u0);
+      while(uart_data_ready(u0))
+        handle_uart_input(u0);
     }
 
-    /* A time change has occurred, update the clock display. */
+    /* A time change has occurred, read the new time. */
     if(ready_flags & READY_UPDATE_HMS)
     {
       ready_flags &= ~READY_UPDATE_HMS;
+      update_hms_async();
+    }
+
+    /* The RTC read has completed, update the clock display. */
+    if(ready_flags & READY_RTC_DATA)
+    {
       update_hms();
     }
 
+    /* A GPS read queued by update_hms() has completed. */
+    if(ready_flags & READY_GPS_DATA)
+    {
+      handle_gps_data();
+    }
+
+    /* Send any deferred log messages which fit without waiting. */
+    uart_log_flush(u0);
+
     /*
      * Run one loop through the current sequence, with interrupts disabled.
      */
@@ -20,49 +20,23 @@
 #include <i2c.h>
 #include "rtc_ds1307.h"
 
+/* The DS1307 supports only standard mode I2C. */
+const i2c_device_t rtc_ds1307_i2c = I2C_DEVICE(RTC_DS1307_I2C_ID, 100000UL);
+
 uint8_t rtc_ds1307_hardware_init(void)
 {
-  uint8_t rc;
-
-  rc = i2c_start(RTC_DS1307_I2C_ID, I2C_WRITE);
-  if(rc) return 1;
+  uint8_t address = 0x00;
+  uint8_t seconds;
 
-  rc = i2c_write(0x00);
-  if(rc) return 2;
-
-  i2c_stop();
-
-  rc = i2c_rep_start(RTC_DS1307_I2C_ID, I2C_READ);
-  if(rc) return 3;
-
-  i2c_read_nak();
-  i2c_stop();
-
-  return 0;
+  /* Probe the device by reading back its first register. */
+  return i2c_write_read(&rtc_ds1307_i2c, &address, 1, &seconds, 1);
 }
+
 uint8_t rtc_ds1307_read_ram(uint8_t address, uint8_t length, unsigned char *data)
 {
-  uint8_t rc;
-  uint8_t pos;
-
-  rc = i2c_start(RTC_DS1307_I2C_ID, I2C_WRITE);
-  if(rc) return 1;
-
-  rc = i2c_write(address);
-  if(rc) return 2;
-
-  i2c_stop();
-
-  rc = i2c_rep_start(RTC_DS1307_I2C_ID, I2C_READ);
-  if(rc) return 3;
-
-  for(pos=0; pos < length; pos++, data++)
-  {
-    *data = (char)i2c_read(pos != (length-1));
-  }
-  i2c_stop();
-
-  return 0;
+  /* Set the register pointer, then read from it after a repeated START. */
+  return i2c_write_read(&rtc_ds1307_i2c, &address, 1,
+                        (uint8_t *)data, length);
 }
 
 uint8_t rtc_ds1307_write_ram(uint8_t address, uint8_t length, unsigned char *data)
@@ -70,11 +44,15 @@ uint8_t rtc_ds1307_write_ram(uint8_t address, uint8_t length, unsigned char *dat
   uint8_t rc;
   uint8_t pos;
 
-  rc = i2c_start(RTC_DS1307_I2C_ID, I2C_WRITE);
+  rc = i2c_device_start(&rtc_ds1307_i2c, I2C_WRITE);
   if(rc) return 1;
 
   rc = i2c_write(address);
-  if(rc) return 2;
+  if(rc)
+  {
+    i2c_stop();
+    return 2;
+  }
 
   for(pos=0; pos < length; pos++, data++)
   {
@@ -221,31 +199,40 @@ uint8_t rtc_ds1307_sqw_rate(uint16_t rate)
   return 0;
 }
 
-uint8_t rtc_ds1307_read(rtc_datetime_24h_t *dt)
+/*
+ * Decode the clock registers, as read from address 0x00, for example by a
+ * transaction queued with i2c_submit().
+ */
+uint8_t rtc_ds1307_decode_clock_raw(rtc_ds1307_clock_raw_t *raw, rtc_datetime_24h_t *dt)
 {
-  uint8_t rc;
-  rtc_ds1307_clock_raw_t raw;
-
-  rc = rtc_ds1307_read_clock_raw(&raw);
-  if(rc) return rc;
-
-  if(raw.control_mode_24h == RTC_DS1307_HOUR_STYLE_12H)
+  if(raw->control_mode_24h == RTC_DS1307_HOUR_STYLE_12H)
     return 100;
 
-  dt->year   = (raw.year_1   * 10) + raw.year_0;
-  dt->month  = (raw.month_1  * 10) + raw.month_0;
-  dt->date   = (raw.date_1   * 10) + raw.date_0;
-  dt->hour   = (raw.hour_1   * 10) + raw.hour_0;
-  dt->minute = (raw.minute_1 * 10) + raw.minute_0;
-  dt->second = (raw.second_1 * 10) + raw.second_0;
+  dt->year   = (raw->year_1   * 10) + raw->year_0;
+  dt->month  = (raw->month_1  * 10) + raw->month_0;
+  dt->date   = (raw->date_1   * 10) + raw->date_0;
+  dt->hour   = (raw->hour_1   * 10) + raw->hour_0;
+  dt->minute = (raw->minute_1 * 10) + raw->minute_0;
+  dt->second = (raw->second_1 * 10) + raw->second_0;
   dt->millisecond = 0; /* Not supported by this RTC */
-  dt->day_of_week = raw.day_of_week;
+  dt->day_of_week = raw->day_of_week;
 
   dt->year += (dt->year < RTC_DS1307_YEAR_EPOCH)?2000:1900;
 
   return 0;
 }
 
+uint8_t rtc_ds1307_read(rtc_datetime_24h_t *dt)
+{
+  uint8_t rc;
+  rtc_ds1307_clock_raw_t raw;
+
+  rc = rtc_ds1307_read_clock_raw(&raw);
+  if(rc) return rc;
+
+  return rtc_ds1307_decode_clock_raw(&raw, dt);
+}
+
 uint8_t rtc_ds1307_write(rtc_datetime_24h_t *dt)
 {
   uint8_t rc;
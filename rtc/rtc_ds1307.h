@@ -22,6 +22,7 @@
 
 #include <inttypes.h>
 #include <avr/io.h>
+#include <i2c.h>
 
 #include "rtc_types.h"
 
@@ -87,6 +88,9 @@ typedef struct _rtc_ds1307_clock_raw_t
   uint8_t control_out:1;
 } rtc_ds1307_clock_raw_t;
 
+extern const i2c_device_t rtc_ds1307_i2c;
 extern rtc_device_t rtc_ds1307;
 
+extern uint8_t rtc_ds1307_decode_clock_raw(rtc_ds1307_clock_raw_t *raw, rtc_datetime_24h_t *dt);
+
 #endif /* RTC_DS1307_H */
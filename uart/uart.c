@@ -23,6 +23,7 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
+#include <util/atomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,242 +32,1551 @@
  *  Module global variables
  */
 
-uart_instance_t *uart_instances = NULL;
-uart_stdout_t uart_stdout;
+uart_t *uart_instances[UART_COUNT];
+uart_stream_t uart_stdout;
+uart_stream_t uart_stderr;
 
 #include "uart_quirks.h"
 
-#if defined(UART0_RXC_INT) && defined(UART0_DRE_INT)
-ISR(UART0_RXC_INT)    { uart_isr_rxc("0"); }
-ISR(UART0_DRE_INT)    { uart_isr_dre("0"); }
+/*
+ * Write a byte to a UART's data register to transmit it.  The host build
+ * (see uart_host/) simulates the transmitter, so it must see each write.
+ */
+#if defined(UART_HOST)
+extern void uart_host_write(volatile uint8_t *data_register, uint8_t data);
+#define UART_DATA_WRITE(data_register, data) \
+  uart_host_write((data_register), (data))
+#else
+#define UART_DATA_WRITE(data_register, data) (*(data_register) = (data))
+#endif
+
+/*
+ * Statically allocated storage for each UART present, with its buffers
+ * sized individually at compile time.
+ */
+#if UART_RX_ERROR_TAGGING
+#define UART_RX_ERRORS(n) \
+  static unsigned char uart##n##_rx_errors[UART##n##_RX_BUFFER_SIZE];
+#define UART_RX_ERRORS_P(n) uart##n##_rx_errors
+#else
+#define UART_RX_ERRORS(n)
+#define UART_RX_ERRORS_P(n) NULL
+#endif
+
+#if UART_RX_TIMESTAMPS == UART_RX_TIMESTAMPS_BYTE
+#define UART_RX_TIMESTAMPS_A(n) \
+  static uart_timestamp_t uart##n##_rx_timestamps[UART##n##_RX_BUFFER_SIZE];
+#define UART_RX_TIMESTAMPS_P(n) uart##n##_rx_timestamps
+#else
+#define UART_RX_TIMESTAMPS_A(n)
+#define UART_RX_TIMESTAMPS_P(n) NULL
+#endif
+
+#define UART_BUFFERS(n) \
+  static unsigned char uart##n##_rx_buffer[UART##n##_RX_BUFFER_SIZE]; \
+  static unsigned char uart##n##_tx_buffer[UART##n##_TX_BUFFER_SIZE]; \
+  UART_RX_ERRORS(n) \
+  UART_RX_TIMESTAMPS_A(n)
+
+#define UART_STORAGE(n) \
+  { \
+    .tx = { uart##n##_tx_buffer, NULL, NULL, UART##n##_TX_BUFFER_SIZE - 1 }, \
+    .rx = { uart##n##_rx_buffer, UART_RX_ERRORS_P(n), UART_RX_TIMESTAMPS_P(n), \
+      UART##n##_RX_BUFFER_SIZE - 1 } \
+  }
+
+UART_BUFFERS(0)
+#if UART_COUNT > 1
+UART_BUFFERS(1)
+#endif
+#if UART_COUNT > 2
+UART_BUFFERS(2)
+#endif
+#if UART_COUNT > 3
+UART_BUFFERS(3)
+#endif
+
+static uart_t uart_storage[UART_COUNT] = {
+  UART_STORAGE(0),
+#if UART_COUNT > 1
+  UART_STORAGE(1),
+#endif
+#if UART_COUNT > 2
+  UART_STORAGE(2),
+#endif
+#if UART_COUNT > 3
+  UART_STORAGE(3),
+#endif
+};
+
+/*
+ * Read or write a buffer index shared with an ISR from outside of the ISR.
+ * Wide indexes take more than one instruction to access, so interrupts must
+ * be disabled to avoid seeing or leaving a half-updated value.
+ */
+static inline uart_index_t uart_index_get(volatile uart_index_t *index)
+{
+#if defined(UART_BUFFER_INDEX_WIDE)
+  uart_index_t value;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    value = *index;
+  }
+  return value;
+#else
+  return *index;
+#endif
+}
+
+static inline void uart_index_set(volatile uart_index_t *index, uart_index_t value)
+{
+#if defined(UART_BUFFER_INDEX_WIDE)
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    *index = value;
+  }
+#else
+  *index = value;
+#endif
+}
+
+#if UART_STATISTICS
+#define UART_STATISTIC(x) x
+#else
+#define UART_STATISTIC(x)
+#endif
+
+/*
+ * Time an ISR body with UART_TIMER_COUNTER, if statistics are enabled and a
+ * timer is available.  The ISR's register saving and restoring is not
+ * included.
+ */
+#if UART_STATISTICS && defined(UART_TIMER_COUNTER)
+#define UART_TIMER_START() uint16_t uart_timer_start = UART_TIMER_COUNTER
+#define UART_TIMER_STOP(time) uart_timer_stop(&(time), uart_timer_start)
+
+static inline void uart_timer_stop(uart_isr_time_t *time, uint16_t start)
+{
+  uint16_t elapsed = UART_TIMER_COUNTER - start;
+
+  time->total += elapsed;
+  if(elapsed > time->max)
+    time->max = elapsed;
+}
+#else
+#define UART_TIMER_START()
+#define UART_TIMER_STOP(time)
+#endif
+
+/*
+ * Record the peak number of bytes held in a buffer.
+ */
+#define UART_STATISTIC_PEAK(peak, head, tail, mask) \
+  UART_STATISTIC({ \
+    uart_index_t used = ((head) - (tail)) & (mask); \
+    if(used > (peak)) \
+      (peak) = used; \
+  })
+
+/*
+ * Whether the peer has asked us to stop transmitting, by CTS or XOFF.
+ */
+static inline uint8_t uart_flow_tx_stopped(uart_t *uart)
+{
+  if(uart->flow.cts)
+    uart->flow.tx_stopped = (*uart->flow.cts->pin & uart->flow.cts->bv) != 0;
+
+  return uart->flow.tx_stopped;
+}
+
+/*
+ * In half-duplex mode, take the bus before transmitting, by driving the
+ * driver enable pin high.  It is released by the TXC interrupt once the
+ * transmission is complete.  Must be called with interrupts disabled.
+ */
+static inline void uart_rs485_transmit(uart_t *uart)
+{
+  if(uart->rs485.enabled && !uart->rs485.transmitting)
+  {
+    uart->rs485.transmitting = 1;
+    if(uart->rs485.de)
+      *uart->rs485.de->port |= uart->rs485.de->bv;
+  }
+}
+
+/*
+ * If nothing is queued for transmission and the UART's data register is
+ * empty, write data directly to the UART instead of queueing it and taking a
+ * UDRE interrupt to move it.  Interrupts are disabled so that the UDRE ISR
+ * can't run between the check and the write.  Returns 1 if data was written.
+ */
+static inline uint8_t uart_tx_direct(uart_t *uart, unsigned char data)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if(uart->tx.head == uart->tx.tail
+        && !uart->flow.pending
+        && !uart_flow_tx_stopped(uart)
+        && (*uart->description->registers.status & uart->description->status_udre))
+    {
+      uart_rs485_transmit(uart);
+      UART_DATA_WRITE(uart->description->registers.data, data);
+      /* Take the UDRE interrupt anyway, to report the buffer drained */
+      if(uart->tx_drained_callback)
+        *uart->description->registers.control |= uart->description->control_udrie;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Tell the peer to stop (go = 0) or resume (go = 1) sending, by RTS or by
+ * queueing XOFF or XON to be sent next.  Must be called with interrupts
+ * disabled.
+ */
+static void uart_flow_rx(uart_t *uart, uint8_t go)
+{
+  uart->flow.rx_stopped = !go;
+
+  if(uart->flow.rts)
+  {
+    if(go)
+      *uart->flow.rts->port &= ~uart->flow.rts->bv;
+    else
+      *uart->flow.rts->port |= uart->flow.rts->bv;
+  }
+
+  if(uart->flow.mode == UART_FLOW_XON_XOFF)
+  {
+    uart->flow.pending = go ? UART_XON : UART_XOFF;
+    *uart->description->registers.control |= uart->description->control_udrie;
+  }
+}
+
+/*
+ * After reading, let the peer resume sending once the receive buffer has
+ * been drained to its low watermark, or in line mode, once a slot is free to
+ * receive another line into after the one being filled.
+ */
+static inline void uart_flow_rx_drained(uart_t *uart)
+{
+  if(!uart->flow.rx_stopped)
+    return;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if(uart->line.enabled
+        ? uart->line.complete < UART_LINE_SLOTS - 1
+        : ((uart->rx.head - uart->rx.tail) & uart->rx.mask) <= uart->rx.low)
+      uart_flow_rx(uart, 1);
+  }
+}
+
+/*
+ * Called after data has been read from the receive buffer, to re-arm the RX
+ * threshold callback once the buffer is below the threshold again, and to
+ * restart the peer if it was stopped.
+ */
+static inline void uart_rx_drained(uart_t *uart)
+{
+  if(uart->rx_threshold && !uart->rx_threshold_armed)
+  {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      if(((uart->rx.head - uart->rx.tail) & uart->rx.mask) < uart->rx_threshold)
+        uart->rx_threshold_armed = 1;
+    }
+  }
+
+  uart_flow_rx_drained(uart);
+}
+
+/*
+ * Increment an error counter, saturating at its maximum.
+ */
+static inline void uart_count_error(uint16_t *counter)
+{
+  if(*counter != UINT16_MAX)
+    (*counter)++;
+}
+
+/*
+ * Receive a byte in line mode, appending it to the line being filled.  When
+ * the delimiter is received, the line is NUL-terminated and completed, and
+ * filling moves on to the next slot if one is free.  If no slot is free, or
+ * the line doesn't fit in its slot, the line is discarded.  Returns 1 if a
+ * line was completed.
+ */
+static uint8_t uart_rxc_line(uart_t *uart, unsigned char data, unsigned char rx_error)
+{
+  unsigned char *slot;
+
+  slot = (unsigned char *)&uart->rx.buffer[uart->line.fill * uart->line.slot_size];
+
+  /* Skip the remainder of a discarded line */
+  if(uart->line.discarding)
+  {
+    if(data == uart->line.delimiter)
+      uart->line.discarding = 0;
+    return 0;
+  }
+
+  /* Always leave room for the NUL terminator */
+  if(uart->line.position >= uart->line.slot_size - 1)
+  {
+    /* error: line too long for slot, discard it and tag the next line */
+    uart->line.position = 0;
+    uart->line.discarding = (data != uart->line.delimiter);
+    uart->rx.error |= UART_BUFFER_OVERFLOW >> 8;
+    uart_count_error(&uart->errors.overflow);
+    return 0;
+  }
+
+  /* Start the line's errors with any overflow since the last line */
+  if(uart->line.position == 0)
+  {
+    uart->line.error[uart->line.fill] = uart->rx.error;
+    uart->rx.error = 0;
+  }
+
+  slot[uart->line.position++] = data;
+  uart->line.error[uart->line.fill] |= rx_error;
+
+  if(data != uart->line.delimiter)
+    return 0;
+
+  slot[uart->line.position] = 0;
+
+  if(uart->line.complete >= UART_LINE_SLOTS - 1)
+  {
+    /* error: no free slot to continue filling, discard the line */
+    uart->line.position = 0;
+    uart->rx.error |= UART_BUFFER_OVERFLOW >> 8;
+    uart_count_error(&uart->errors.overflow);
+    return 0;
+  }
+
+  uart->line.length[uart->line.fill] = uart->line.position;
+  uart->line.fill = (uart->line.fill + 1) & (UART_LINE_SLOTS - 1);
+  uart->line.complete++;
+  uart->line.position = 0;
+
+  return 1;
+}
+
+/*
+ * The bodies of the RX complete and data register empty interrupts.  These
+ * are always inlined so that when the register addresses and masks passed
+ * in are constants, the compiler is able to emit direct I/O instructions for
+ * them.
+ */
+static inline void uart_rxc(uart_t *uart,
+    volatile uint8_t *status, volatile uint8_t *data_register,
+    uint8_t error_fe, uint8_t error_dor,
+    uart_index_t rx_mask) __attribute__((always_inline));
+
+static inline void uart_dre(uart_t *uart,
+    volatile uint8_t *control, volatile uint8_t *data_register,
+    uint8_t udrie, uart_index_t tx_mask) __attribute__((always_inline));
+
+static inline void uart_rxc(uart_t *uart,
+    volatile uint8_t *status, volatile uint8_t *data_register,
+    uint8_t error_fe, uint8_t error_dor,
+    uart_index_t rx_mask)
+{
+  uart_index_t tmp_rx_head;
+  unsigned char data;
+  unsigned char usr;
+  unsigned char rx_error = 0;
+#if UART_RX_TIMESTAMPS
+  /* Read the time first, as the byte has just finished arriving */
+  uart_timestamp_t timestamp = UART_RX_TIMESTAMP_COUNTER;
+#endif
+
+  /* Read UART status register and UART data register */
+  usr  = *status;
+
+  if(uart->rs485.multiprocessor)
+  {
+    /* The ninth bit must be read before the data register */
+    if(*uart->description->registers.control & uart->description->control_rxb8)
+    {
+      /*
+       * An address frame: a slave receives the following data frames only
+       * if addressed, and otherwise leaves the hardware to ignore them.
+       */
+      data = *data_register;
+      if(uart->rs485.address != UART_MPCM_MASTER)
+      {
+        uart->rs485.selected = (data == uart->rs485.address
+            || data == UART_MPCM_BROADCAST);
+        *status = (usr & uart->description->status_u2x)
+          | (uart->rs485.selected ? 0 : uart->description->status_mpcm);
+      }
+      return;
+    }
+  }
+
+  data = *data_register;
+
+  /* Data for another slave, on a part without hardware filtering */
+  if(uart->rs485.multiprocessor && !uart->rs485.selected)
+    return;
+
+  UART_STATISTIC(uart->statistics.rx_bytes++);
+
+  if(usr & error_fe)
+  {
+    rx_error |= UART_FRAME_ERROR >> 8;
+    uart_count_error(&uart->errors.frame);
+  }
+  if(usr & error_dor)
+  {
+    rx_error |= UART_OVERRUN_ERROR >> 8;
+    uart_count_error(&uart->errors.overrun);
+  }
+
+  if(uart->flow.mode == UART_FLOW_XON_XOFF
+      && (data == UART_XON || data == UART_XOFF))
+  {
+    /* Flow control from the peer, which isn't stored */
+    uart->flow.tx_stopped = (data == UART_XOFF);
+    if(data == UART_XON && uart->tx.head != uart->tx.tail)
+      *uart->description->registers.control |= uart->description->control_udrie;
+    return;
+  }
+
+  if(uart->line.enabled)
+  {
+#if UART_RX_TIMESTAMPS
+    /* Stamp each line with the time of its first byte */
+    if(uart->line.position == 0)
+      uart->line.timestamp[uart->line.fill] = timestamp;
+#endif
+
+    /* In line mode, only call back once each line is complete. */
+    if(uart_rxc_line(uart, data, rx_error))
+    {
+      /* Stop the peer while only the slot being filled is free */
+      if(uart->flow.mode && uart->line.complete >= UART_LINE_SLOTS - 1)
+        uart_flow_rx(uart, 0);
+
+      if(uart->rx_callback)
+        uart->rx_callback(uart);
+    }
+
+    return;
+  }
+
+  /* calculate buffer index */
+  tmp_rx_head = ( uart->rx.head + 1) & rx_mask;
+
+  if ( tmp_rx_head == uart->rx.tail )
+  {
+    /* error: receive buffer overflow, reported with the next byte stored */
+    uart->rx.error |= UART_BUFFER_OVERFLOW >> 8;
+    uart_count_error(&uart->errors.overflow);
+  } else {
+    /* store received data in buffer */
+    uart->rx.buffer[tmp_rx_head] = data;
+#if UART_RX_ERROR_TAGGING
+    /* tag the byte with its own errors, and any overflow before it */
+    uart->rx.errors[tmp_rx_head] = rx_error | uart->rx.error;
+    uart->rx.error = 0;
+#else
+    /* errors accumulate until uart_getc() reports and clears them */
+    uart->rx.error |= rx_error;
+#endif
+#if UART_RX_TIMESTAMPS == UART_RX_TIMESTAMPS_BYTE
+    uart->rx.timestamps[tmp_rx_head] = timestamp;
+#endif
+    /* store new index */
+    uart->rx.head = tmp_rx_head;
+    UART_STATISTIC_PEAK(uart->statistics.rx_peak,
+        tmp_rx_head, uart->rx.tail, rx_mask);
+
+    /* Stop the peer once the buffer fills to its high watermark */
+    if(uart->flow.mode && !uart->flow.rx_stopped
+        && ((tmp_rx_head - uart->rx.tail) & rx_mask) >= uart->rx.high)
+      uart_flow_rx(uart, 0);
+  }
+
+  /* Restart the idle timer, which is counted down by uart_tick() */
+  uart->rx_idle_countdown = uart->rx_idle_timeout;
+
+  if(!uart->rx_callback)
+    return;
+
+  /*
+   * With a threshold set, only call back once as the buffer fills up to it,
+   * rather than for every byte received.  The callback is armed again once
+   * the buffer has been read back below the threshold.
+   */
+  if(uart->rx_threshold)
+  {
+    if(((uart->rx.head - uart->rx.tail) & rx_mask) < uart->rx_threshold)
+    {
+      uart->rx_threshold_armed = 1;
+      return;
+    }
+    if(!uart->rx_threshold_armed)
+      return;
+    uart->rx_threshold_armed = 0;
+  }
+
+  uart->rx_callback(uart);
+}
+
+static inline void uart_dre(uart_t *uart,
+    volatile uint8_t *control, volatile uint8_t *data_register,
+    uint8_t udrie, uart_index_t tx_mask)
+{
+  uart_index_t tmp_tx_tail;
+
+  if(uart->flow.pending)
+  {
+    /* Send flow control to the peer ahead of any data */
+    uart_rs485_transmit(uart);
+    UART_DATA_WRITE(data_register, uart->flow.pending);
+    uart->flow.pending = 0;
+    return;
+  }
+
+  if(uart_flow_tx_stopped(uart))
+  {
+    /* The peer can't receive, wait for uart_flow_cts_changed() or XON */
+    *control &= ~udrie;
+    return;
+  }
+
+  if ( uart->tx.head != uart->tx.tail)
+  {
+    /* Calculate and store new buffer index */
+    tmp_tx_tail = (uart->tx.tail + 1) & tx_mask;
+    uart->tx.tail = tmp_tx_tail;
+    uart_rs485_transmit(uart);
+    /* Get one byte from buffer and write it to UART */
+    UART_DATA_WRITE(data_register, uart->tx.buffer[tmp_tx_tail]);  /* start transmission */
+  } else {
+    /* TX buffer empty, disable UDRE interrupt */
+    *control &= ~udrie;
+
+    if(uart->tx_drained_callback)
+      uart->tx_drained_callback(uart);
+  }
+}
+
+/*
+ * The body of the TX complete interrupt, only enabled in half-duplex mode,
+ * which releases the bus once the last byte queued has been shifted out.
+ */
+static inline void uart_txc(uart_t *uart,
+    volatile uint8_t *status, uint8_t udre)
+{
+  if(uart->tx.head != uart->tx.tail || uart->flow.pending || !(*status & udre))
+    return;
+
+  uart->rs485.transmitting = 0;
+  if(uart->rs485.de)
+    *uart->rs485.de->port &= ~uart->rs485.de->bv;
+}
+
+#if defined(UART_SPECIALIZED_ISR)
+/*
+ * Generate each UART's ISRs with its register addresses and masks from
+ * uart_quirks.h as constants, rather than loading them at runtime from its
+ * uart_description_t.  The generic uart_isr_rxc() and uart_isr_dre() remain
+ * available for UARTs selected at runtime.
+ */
+#define UART_ISRS(n) \
+  ISR(UART##n##_RXC_INT) \
+  { \
+    UART_TIMER_START(); \
+    uart_rxc(uart_instances[n], &UART##n##_STATUS, &UART##n##_DATA, \
+        UART##n##_ERROR_FE, UART##n##_ERROR_DOR, \
+        UART##n##_RX_BUFFER_SIZE - 1); \
+    UART_TIMER_STOP(uart_instances[n]->statistics.rxc_time); \
+  } \
+  ISR(UART##n##_DRE_INT) \
+  { \
+    UART_TIMER_START(); \
+    uart_dre(uart_instances[n], &UART##n##_CONTROL, &UART##n##_DATA, \
+        UART##n##_UDRIE, UART##n##_TX_BUFFER_SIZE - 1); \
+    UART_TIMER_STOP(uart_instances[n]->statistics.dre_time); \
+  } \
+  ISR(UART##n##_TXC_INT) \
+  { \
+    uart_txc(uart_instances[n], &UART##n##_STATUS, UART##n##_UDRE); \
+  }
+#else
+#define UART_ISRS(n) \
+  ISR(UART##n##_RXC_INT) { uart_isr_rxc(uart_instances[n]); } \
+  ISR(UART##n##_DRE_INT) { uart_isr_dre(uart_instances[n]); } \
+  ISR(UART##n##_TXC_INT) { uart_isr_txc(uart_instances[n]); }
+#endif
+
+#if defined(UART0_RXC_INT) && defined(UART0_DRE_INT) && defined(UART0_TXC_INT)
+UART_ISRS(0)
+#endif
+
+#if defined(UART1_RXC_INT)
+UART_ISRS(1)
+#endif
+
+#if defined(UART2_RXC_INT)
+UART_ISRS(2)
+#endif
+
+#if defined(UART3_RXC_INT)
+UART_ISRS(3)
+#endif
+
+
+uart_t *uart_by_name(char *name)
+{
+  uart_description_t *description;
+
+  description = uart_description_by_name(name);
+  if(description == NULL)
+    return NULL;
+
+  return uart_instances[description - uart_descriptions];
+}
+
+uart_description_t *uart_description_by_name(char *name)
+{
+  uart_description_t *d;
+  for(d=uart_descriptions; d->name; d++)
+  {
+    if(!(strcmp(d->name, name)))
+      return d;
+  }
+  return NULL;
+}
+
+/*
+ * Choose the UBRR value and U2X setting for baud_rate at runtime, as
+ * UART_BAUD_AUTO() does at compile time.
+ */
+unsigned int uart_baud_select(uint32_t baud_rate, uint32_t xtal_cpu)
+{
+  if(baud_rate == 0)
+    return UART_BAUD_INVALID;
+
+  return UART_BAUD_AUTO(baud_rate, xtal_cpu);
+}
+
+/*
+ * The function behind the uart_init() macro, for callers taking its address.
+ */
+uart_t *(uart_init)(char *name, uint32_t baud_rate)
+{
+  return uart_init_ubrr(name, uart_baud_select(baud_rate, F_CPU));
+}
+
+/*
+ * Initialize a UART with a raw UBRR value, optionally with UART_BAUD_RATE_2X
+ * set, such as from UART_BAUD_SELECT().
+ */
+uart_t *uart_init_ubrr(char *name, unsigned int baudrate)
+{
+  uart_t *uart;
+  uart_description_t *description;
+
+  description = uart_description_by_name(name);
+  if(description == NULL)
+    return NULL;
+
+  if(baudrate == UART_BAUD_INVALID
+      || ((baudrate & UART_BAUD_RATE_2X) && !description->status_u2x))
+    return NULL;
+
+  uart = &uart_storage[description - uart_descriptions];
+  uart->tx.head = 0;
+  uart->tx.tail = 0;
+  uart->rx.head = 0;
+  uart->rx.tail = 0;
+  uart->rx.error = 0;
+  uart->rx.read_error = 0;
+  uart->rx.high = uart->rx.mask - uart->rx.mask / 4;
+  uart->rx.low = uart->rx.mask / 4;
+  uart->line.enabled = 0;
+  uart->flow.mode = UART_FLOW_NONE;
+  uart->flow.rts = NULL;
+  uart->flow.cts = NULL;
+  uart->flow.rx_stopped = 0;
+  uart->flow.tx_stopped = 0;
+  uart->flow.pending = 0;
+  uart->rs485.enabled = 0;
+  uart->rs485.de = NULL;
+  uart->rs485.transmitting = 0;
+  uart->rs485.multiprocessor = 0;
+  uart->rs485.address = UART_MPCM_MASTER;
+  uart->rs485.selected = 1;
+  uart->bridge.to = NULL;
+  uart->bridge.dropped = 0;
+  uart_reset_error_counters(uart);
+#if UART_STATISTICS
+  uart_reset_statistics(uart);
+#endif
+  uart->rx_threshold = 0;
+  uart->rx_threshold_armed = 1;
+  uart->rx_idle_timeout = 0;
+  uart->rx_idle_countdown = 0;
+  uart->rx_callback = NULL;
+  uart->tx_drained_callback = NULL;
+  uart->description = description;
+
+  /* Register before enabling interrupts, so the ISRs can find this UART. */
+  uart_instances[description - uart_descriptions] = uart;
+
+  uart_set_baudrate(uart, baudrate);
+
+  /* Set frame format: asynchronous, 8data, no parity, 1stop bit */
+  uart_set_frame_format(uart,
+      uart->description->format_async
+    | uart->description->format_8n1);
+
+  /* Enable UART receiver, transmitter, and RX complete interrupt. */
+  if(uart->description->control_enable)
+  {
+    *uart->description->registers.control |= uart->description->control_enable;
+  }
+
+  return uart;
+}
+
+void uart_set_baudrate(uart_t *uart, unsigned int baudrate)
+{
+  if(uart->description->status_u2x)
+  {
+    /*
+     * Enable or disable 2x speed.  The status register's error flags must
+     * be written as zero, so it is written outright rather than modified.
+     */
+    *uart->description->registers.status =
+      (baudrate & UART_BAUD_RATE_2X) ? uart->description->status_u2x : 0;
+  }
+
+  baudrate &= ~UART_BAUD_RATE_2X;
+
+  /* Set baud rate */
+  if(uart->description->registers.baud_h)
+  {
+    *uart->description->registers.baud_h = (unsigned char) (baudrate >> 8);
+  }
+
+  *uart->description->registers.baud_l = (unsigned char) (baudrate & 0x00ff);
+}
+
+void uart_set_frame_format(uart_t *uart, int frame_format)
+{
+  /* TODO: Make this resettable by not just using |= */
+  *uart->description->registers.format |= frame_format;
+}
+
+void uart_set_rx_callback(uart_t *uart, void (*rx_callback)(uart_t *))
+{
+  uart->rx_callback = rx_callback;
+}
+
+/*
+ * Take a consistent snapshot of the UART's receive error counters.
+ */
+void uart_get_error_counters(uart_t *uart, uart_error_counters_t *counters)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    *counters = uart->errors;
+  }
+}
+
+void uart_reset_error_counters(uart_t *uart)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    uart->errors.frame = 0;
+    uart->errors.overrun = 0;
+    uart->errors.overflow = 0;
+  }
+}
+
+#if UART_STATISTICS
+/*
+ * Take a consistent snapshot of the UART's statistics.
+ */
+void uart_get_statistics(uart_t *uart, uart_statistics_t *statistics)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    *statistics = uart->statistics;
+  }
+}
+
+void uart_reset_statistics(uart_t *uart)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    memset(&uart->statistics, 0, sizeof(uart->statistics));
+  }
+}
 #endif
 
-#if defined(USART1_RX_vect)
-ISR(USART1_RX_vect)   { uart_isr_rxc("1"); }
-ISR(USART1_UDRE_vect) { uart_isr_dre("1"); }
-#endif
+/*
+ * Only call the RX callback when the receive buffer fills to threshold
+ * bytes, rather than for every byte received.  A threshold of 0 (the
+ * default) calls back for every byte.  The threshold is limited to the
+ * most the receive buffer can hold.
+ */
+void uart_set_rx_threshold(uart_t *uart, uint16_t threshold)
+{
+  if(threshold > uart->rx.mask)
+    threshold = uart->rx.mask;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    uart->rx_threshold = threshold;
+    uart->rx_threshold_armed = 1;
+  }
+}
+
+/*
+ * Also call the RX callback once the receiver has been idle for ticks calls
+ * of uart_tick() with data waiting in the receive buffer, so that the end of
+ * a burst smaller than the threshold is noticed.  See UART_IDLE_TICKS() to
+ * convert from character times.  A timeout of 0 (the default) disables it.
+ */
+void uart_set_rx_idle_timeout(uart_t *uart, uint16_t ticks)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    uart->rx_idle_timeout = ticks;
+    uart->rx_idle_countdown = 0;
+  }
+}
+
+/*
+ * Count down the RX idle timers of all UARTs.  This should be called at a
+ * fixed rate from an application's timer ISR if any idle timeouts are used.
+ */
+void uart_tick(void)
+{
+  uint8_t i;
+  uart_t *uart;
+
+  for(i=0; i < UART_COUNT; i++)
+  {
+    uart = uart_instances[i];
+    if(uart == NULL || uart->rx_idle_countdown == 0)
+      continue;
+
+    if(--uart->rx_idle_countdown == 0
+        && uart->rx.head != uart->rx.tail
+        && uart->rx_callback)
+      uart->rx_callback(uart);
+  }
+}
+
+/*
+ * Enable flow control in both directions, or disable it with
+ * UART_FLOW_NONE.  With UART_FLOW_RTS_CTS, rts is an output driven high to
+ * stop the peer, and cts an input read high when the peer asks us to stop;
+ * either may be NULL.  Changes on cts must be reported by calling
+ * uart_flow_cts_changed(), e.g. from a pin change interrupt.  With
+ * UART_FLOW_XON_XOFF, the pins are ignored, and XON and XOFF are not
+ * received as data.
+ */
+void uart_set_flow_control(uart_t *uart, uint8_t mode, uart_pin_t *rts, uart_pin_t *cts)
+{
+  if(mode != UART_FLOW_RTS_CTS)
+    rts = cts = NULL;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    uart->flow.mode = mode;
+    uart->flow.rts = rts;
+    uart->flow.cts = cts;
+    uart->flow.rx_stopped = 0;
+    uart->flow.tx_stopped = 0;
+    uart->flow.pending = 0;
+
+    if(rts)
+    {
+      /* Output, initially low to let the peer send */
+      *rts->port &= ~rts->bv;
+      *rts->ddr |= rts->bv;
+    }
+
+    if(cts)
+      *cts->ddr &= ~cts->bv;
+
+    /* Resume transmitting, in case it was stopped before */
+    if(uart->tx.head != uart->tx.tail)
+      *uart->description->registers.control |= uart->description->control_udrie;
+  }
+}
+
+/*
+ * Set the receive buffer fill level at which the peer is stopped, and the
+ * level it must be drained to before the peer may resume.  The high
+ * watermark should leave room for the bytes the peer may send before it
+ * reacts.  By default these are 3/4 and 1/4 of the buffer.  The high
+ * watermark is kept between 1 and the most the buffer can hold, and the low
+ * watermark below it.
+ */
+void uart_set_rx_watermarks(uart_t *uart, uint16_t high, uint16_t low)
+{
+  if(high > uart->rx.mask)
+    high = uart->rx.mask;
+  if(high == 0)
+    high = 1;
+  if(low >= high)
+    low = high - 1;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    uart->rx.high = high;
+    uart->rx.low = low;
+  }
+}
+
+/*
+ * Resume transmitting if CTS has been asserted, to be called when the CTS pin
+ * changes.  Transmission is stopped on CTS being deasserted regardless, but
+ * only after the byte in progress.
+ */
+void uart_flow_cts_changed(uart_t *uart)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if(!uart_flow_tx_stopped(uart) && uart->tx.head != uart->tx.tail)
+      *uart->description->registers.control |= uart->description->control_udrie;
+  }
+}
+
+/*
+ * Switch the UART to half-duplex operation, as on an RS-485 bus, driving de
+ * (the transceiver's driver enable, and usually its receiver disable) high
+ * only while transmitting.  de may be NULL if the transceiver switches
+ * itself.
+ */
+void uart_set_rs485(uart_t *uart, uart_pin_t *de)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if(de)
+    {
+      /* Output, initially low to leave the bus free */
+      *de->port &= ~de->bv;
+      *de->ddr |= de->bv;
+    }
+
+    uart->rs485.de = de;
+    uart->rs485.transmitting = 0;
+    uart->rs485.enabled = 1;
+    *uart->description->registers.control |= uart->description->control_txcie;
+  }
+}
+
+/*
+ * Switch the UART to multiprocessor communication mode, with 9-bit frames.
+ * With an address other than UART_MPCM_MASTER, the UART acts as a slave at
+ * that address, receiving only the data addressed to it or broadcast; on
+ * parts with MPCM, the data for other slaves doesn't interrupt at all.
+ * Also enables half-duplex mode if it isn't already.
+ */
+void uart_set_multiprocessor(uart_t *uart, uint8_t address)
+{
+  if(!uart->rs485.enabled)
+    uart_set_rs485(uart, NULL);
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    uart->rs485.multiprocessor = 1;
+    uart->rs485.address = address;
+    uart->rs485.selected = (address == UART_MPCM_MASTER);
+
+    *uart->description->registers.control |= uart->description->control_ucsz2;
+    *uart->description->registers.control &= ~uart->description->control_txb8;
+    *uart->description->registers.status =
+      (*uart->description->registers.status & uart->description->status_u2x)
+      | (uart->rs485.selected ? 0 : uart->description->status_mpcm);
+  }
+}
 
-#if defined(USART2_RX_vect)
-ISR(USART2_RX_vect)   { uart_isr_rxc("2"); }
-ISR(USART2_UDRE_vect) { uart_isr_dre("2"); }
-#endif
+/*
+ * As a multiprocessor master, select the slave(s) at address to receive the
+ * data sent after it.  Waits for anything already queued to be sent, since
+ * the address must be sent with the ninth bit set.
+ */
+void uart_send_address(uart_t *uart, uint8_t address)
+{
+  uart_description_t *d = uart->description;
 
-#if defined(USART3_RX_vect)
-ISR(USART3_RX_vect)   { uart_isr_rxc("3"); }
-ISR(USART3_UDRE_vect) { uart_isr_dre("3"); }
-#endif
+  for(;;)
+  {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      if(uart->tx.head == uart->tx.tail && !uart->flow.pending
+          && !uart->rs485.transmitting)
+      {
+        /*
+         * The transmitter is idle, so the address moves to the shift
+         * register with its ninth bit as soon as it is written.
+         */
+        uart_rs485_transmit(uart);
+        *d->registers.control |= d->control_txb8;
+        UART_DATA_WRITE(d->registers.data, address);
+        while(!(*d->registers.status & d->status_udre))
+          ;
+        *d->registers.control &= ~d->control_txb8;
+        return;
+      }
+    }
+  }
+}
 
+/*
+ * Set a callback to be called (from the UDRE ISR) each time the transmit
+ * buffer has been emptied into the UART.
+ */
+void uart_set_tx_drained_callback(uart_t *uart, void (*tx_drained_callback)(uart_t *))
+{
+  uart->tx_drained_callback = tx_drained_callback;
+}
 
-inline uart_instance_t *uart_instance_add(uart_t *uart)
+void uart_isr_rxc(uart_t *uart)
 {
-  uart_instance_t *instance, *current;
+  UART_TIMER_START();
+  uart_rxc(uart,
+      uart->description->registers.status,
+      uart->description->registers.data,
+      uart->description->error_fe,
+      uart->description->error_dor,
+      uart->rx.mask);
+  UART_TIMER_STOP(uart->statistics.rxc_time);
+}
 
-  instance = malloc(sizeof(uart_instance_t));
+void uart_isr_dre(uart_t *uart)
+{
+  UART_TIMER_START();
+  uart_dre(uart,
+      uart->description->registers.control,
+      uart->description->registers.data,
+      uart->description->control_udrie,
+      uart->tx.mask);
+  UART_TIMER_STOP(uart->statistics.dre_time);
+}
 
-  if(uart_instances == NULL)
-  {
-    uart_instances = instance;
-  } else {
-    for(current = uart_instances; current->next; current = current->next) { };
-    current->next = instance;
-  }
-  instance->next = NULL;
-  instance->uart = uart;
+void uart_isr_txc(uart_t *uart)
+{
+  uart_txc(uart,
+      uart->description->registers.status,
+      uart->description->status_udre);
+}
 
-  return uart_instances;
+unsigned char uart_data_ready(uart_t *uart)
+{
+  if (uart_index_get(&uart->rx.head) == uart->rx.tail)
+    return 0;
+  return 1;
 }
 
-uart_t *uart_by_name(char *name)
+unsigned int uart_getc(uart_t *uart)
 {
-  uart_instance_t *instance;
-  for(instance=uart_instances; instance; instance = instance->next)
+  uart_index_t tmp_rx_tail;
+  unsigned char data, error;
+
+  if (uart_data_ready(uart) == 0)
+  {
+    return UART_NO_DATA;   /* no data available */
+  }
+
+  /* Calculate new tail of receive buffer */
+  tmp_rx_tail = (uart->rx.tail + 1) & uart->rx.mask;
+
+  /* Get data from new tail of receive buffer */
+  data = uart->rx.buffer[tmp_rx_tail];
+
+#if UART_RX_ERROR_TAGGING
+  /* Get the errors received with this byte */
+  error = uart->rx.errors[tmp_rx_tail];
+#else
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
   {
-    if(!(strcmp(instance->uart->description->name, name)))
-      return instance->uart;
+    error = uart->rx.error;
+    uart->rx.error = 0;
   }
-  return NULL;
+#endif
+
+  /* Adjust tail pointer, allowing writes into buffer to unblock */
+  uart_index_set(&uart->rx.tail, tmp_rx_tail);
+  uart_rx_drained(uart);
+
+  return (error << 8) + data;
 }
 
-uart_description_t *uart_description_by_name(char *name)
+unsigned int uart_peek(uart_t *uart)
 {
-  uart_description_t *d;
-  for(d=uart_descriptions; d; d++)
+  if (uart_data_ready(uart) == 0)
   {
-    if(!(strcmp(d->name, name)))
-      return d;
+    return UART_NO_DATA;   /* no data available */
   }
-  return NULL;
+
+  /* Return the next byte without consuming it */
+  return uart->rx.buffer[(uart->rx.tail + 1) & uart->rx.mask];
 }
 
-uart_t *uart_init(char *name, unsigned int baudrate)
+#if UART_RX_TIMESTAMPS == UART_RX_TIMESTAMPS_BYTE
+/*
+ * Get the time at which the byte which uart_getc() would return next
+ * finished arriving, from UART_RX_TIMESTAMP_COUNTER.  Only valid when
+ * uart_data_ready().
+ */
+uart_timestamp_t uart_rx_timestamp(uart_t *uart)
 {
-  uart_t *uart;
-  uart_description_t *description;
+  return uart->rx.timestamps[(uart->rx.tail + 1) & uart->rx.mask];
+}
+#endif
 
-  description = uart_description_by_name(name);
+/*
+ * Copy up to count bytes out of the receive buffer, stopping after the first
+ * delimiter if one is given (delimiter >= 0).  The data is contiguous in the
+ * buffer except where it wraps around the end, so it is copied in at most two
+ * spans.  The errors received with the data are kept for uart_read_error().
+ * Returns the number of bytes copied.
+ */
+static uint16_t uart_read_spans(uart_t *uart, unsigned char *buffer, uint16_t count, int delimiter)
+{
+  uint16_t available, start, span, copied = 0;
+  unsigned char *found;
+  unsigned char error = 0;
+  uart_index_t tail;
+#if UART_RX_ERROR_TAGGING
+  uint16_t i;
+#endif
 
-  uart = malloc(sizeof(uart_t));
-  uart->tx.buffer = malloc(UART_TX_BUFFER_SIZE);
-  uart->rx.buffer = malloc(UART_RX_BUFFER_SIZE);
-  uart->tx.head = 0;
-  uart->tx.tail = 0;
-  uart->rx.head = 0;
-  uart->rx.tail = 0;
-  uart->rx_callback = NULL;
-  uart->description = description;
+  tail = uart->rx.tail;
+  available = (uart_index_get(&uart->rx.head) - tail) & uart->rx.mask;
+  if(count > available)
+    count = available;
 
-  uart_set_baudrate(uart, baudrate);
+  while(copied < count)
+  {
+    /* Copy from the oldest byte up to the end of the buffer at most */
+    start = (tail + 1) & uart->rx.mask;
+    span = (uint16_t)uart->rx.mask + 1 - start;
+    if(span > count - copied)
+      span = count - copied;
 
-  /* Set frame format: asynchronous, 8data, no parity, 1stop bit */
-  uart_set_frame_format(uart,
-      uart->description->format_async
-    | uart->description->format_8n1);
+    if(delimiter >= 0)
+    {
+      found = memchr((unsigned char *)&uart->rx.buffer[start], delimiter, span);
+      if(found)
+      {
+        span = found - &uart->rx.buffer[start] + 1;
+        count = copied + span;
+      }
+    }
 
-  /* Enable UART receiver, transmitter, and RX complete interrupt. */
-  if(uart->description->control_enable)
+    memcpy(buffer + copied, (unsigned char *)&uart->rx.buffer[start], span);
+#if UART_RX_ERROR_TAGGING
+    for(i = start; i < start + span; i++)
+      error |= uart->rx.errors[i];
+#endif
+    copied += span;
+    tail = (tail + span) & uart->rx.mask;
+  }
+
+#if !UART_RX_ERROR_TAGGING
+  if(copied)
   {
-    *uart->description->registers.control |= uart->description->control_enable;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      error = uart->rx.error;
+      uart->rx.error = 0;
+    }
   }
+#endif
+  uart->rx.read_error = error;
 
-  uart_instance_add(uart);
+  /* Adjust tail pointer once, allowing writes into buffer to unblock */
+  uart_index_set(&uart->rx.tail, tail);
+  uart_rx_drained(uart);
 
-  return uart;
+  return copied;
 }
 
-void uart_set_baudrate(uart_t *uart, unsigned int baudrate)
+uint16_t uart_read(uart_t *uart, unsigned char *buffer, uint16_t count)
+{
+  return uart_read_spans(uart, buffer, count, -1);
+}
+
+uint16_t uart_read_until(uart_t *uart, unsigned char *buffer, uint16_t count, unsigned char delimiter)
+{
+  return uart_read_spans(uart, buffer, count, delimiter);
+}
+
+/*
+ * Get the errors (as with uart_getc()) received with the data returned by
+ * the last uart_read() or uart_read_until(), including UART_BUFFER_OVERFLOW
+ * if any data was lost before or within it.
+ */
+unsigned int uart_read_error(uart_t *uart)
+{
+  return uart->rx.read_error << 8;
+}
+
+/*
+ * Switch the UART's receiver into line mode, delivering each line ending in
+ * delimiter as a contiguous, NUL-terminated string with uart_line_get().
+ * The receive buffer is used to store the lines, and byte-oriented reads
+ * such as uart_getc() return no data while in line mode; any data already
+ * in the receive buffer is discarded.  Returns the longest line (including
+ * its delimiter) which can be received.
+ */
+uint16_t uart_set_line_mode(uart_t *uart, unsigned char delimiter)
 {
-  if( uart->description->status_u2x && (baudrate & UART_BAUD_RATE_2X) )
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
   {
-    /* Enable 2x speed */
-    *uart->description->registers.status = uart->description->status_u2x;
+    uart->line.delimiter = delimiter;
+    uart->line.slot_size = ((uint16_t)uart->rx.mask + 1) / UART_LINE_SLOTS;
+    uart->line.position = 0;
+    uart->line.discarding = 0;
+    /* Discard anything received in byte mode, as the slots overwrite it */
+    uart->rx.head = 0;
+    uart->rx.tail = 0;
+    uart->rx.error = 0;
+    uart->line.fill = 0;
+    uart->line.read = 0;
+    uart->line.complete = 0;
+    uart->line.released = 0;
+    uart->line.enabled = 1;
+    uart->bridge.line = 0;
   }
 
-  baudrate &= ~UART_BAUD_RATE_2X;
+  return uart->line.slot_size - 1;
+}
 
-  /* Set baud rate */
-  if(uart->description->registers.baud_h)
+/*
+ * Get the oldest complete line received in line mode, or NULL if there is
+ * none.  The line remains valid, and may be modified in place, until it is
+ * released with uart_line_release().
+ */
+char *uart_line_get(uart_t *uart, uint16_t *length)
+{
+  if(uart->line.complete == 0)
+    return NULL;
+
+  if(length)
+    *length = uart->line.length[uart->line.read];
+
+  return (char *)&uart->rx.buffer[uart->line.read * uart->line.slot_size];
+}
+
+/*
+ * Get the errors (as with uart_getc()) received during the line returned by
+ * uart_line_get(), including UART_BUFFER_OVERFLOW if any lines were lost
+ * before it.
+ */
+unsigned int uart_line_error(uart_t *uart)
+{
+  if(uart->line.complete == 0)
+    return UART_NO_DATA;
+
+  return uart->line.error[uart->line.read] << 8;
+}
+
+#if UART_RX_TIMESTAMPS
+/*
+ * Get the time at which the first byte of the line returned by
+ * uart_line_get() finished arriving, from UART_RX_TIMESTAMP_COUNTER.
+ */
+uart_timestamp_t uart_line_timestamp(uart_t *uart)
+{
+  return uart->line.timestamp[uart->line.read];
+}
+#endif
+
+/*
+ * Release the line returned by uart_line_get(), making its slot available
+ * to receive another line.
+ */
+void uart_line_release(uart_t *uart)
+{
+  if(uart->line.complete == 0)
+    return;
+
+  uart->line.read = (uart->line.read + 1) & (UART_LINE_SLOTS - 1);
+  uart->line.released++;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
   {
-    *uart->description->registers.baud_h = (unsigned char) (baudrate >> 8);
+    uart->line.complete--;
   }
 
-  *uart->description->registers.baud_l = (unsigned char) (baudrate & 0x00ff);
+  uart_rx_drained(uart);
 }
 
-void uart_set_frame_format(uart_t *uart, int frame_format)
+void uart_putc(uart_t *uart, unsigned char data)
 {
-  /* TODO: Make this resettable by not just using |= */
-  *uart->description->registers.format |= frame_format;
+  uart_index_t tmp_tx_head;
+
+  UART_STATISTIC(uart->statistics.tx_bytes++);
+
+  if(uart_tx_direct(uart, data))
+    return;
+
+  tmp_tx_head = (uart->tx.head + 1) & uart->tx.mask;
+
+  if ( tmp_tx_head == uart_index_get(&uart->tx.tail) )
+  {
+    UART_STATISTIC(uart->statistics.tx_waits++);
+    while ( tmp_tx_head == uart_index_get(&uart->tx.tail) ){
+      /* Wait for free space in buffer. */
+    }
+  }
+
+  uart->tx.buffer[tmp_tx_head] = data;
+  uart_index_set(&uart->tx.head, tmp_tx_head);
+  UART_STATISTIC_PEAK(uart->statistics.tx_peak,
+      tmp_tx_head, uart_index_get(&uart->tx.tail), uart->tx.mask);
+
+  /* enable UDRE interrupt */
+  *uart->description->registers.control |= uart->description->control_udrie;
 }
 
-void uart_set_rx_callback(uart_t *uart, void (*rx_callback)(uart_t *))
+/*
+ * The number of bytes which can currently be written to the transmit buffer
+ * without blocking.
+ */
+uint16_t uart_tx_free(uart_t *uart)
 {
-  uart->rx_callback = rx_callback;
+  return (uart_index_get(&uart->tx.tail) - uart->tx.head - 1) & uart->tx.mask;
 }
 
-void uart_isr_rxc(char *name)
+/*
+ * Queue as much of count bytes as currently fits in the transmit buffer,
+ * copying in at most two spans, before and after the end of the buffer.
+ * Returns the number of bytes queued, which may be zero.
+ */
+uint16_t uart_write_nonblocking(uart_t *uart, const unsigned char *buffer, uint16_t count)
 {
-  uart_t *uart;
-  unsigned char tmp_rx_head;
-  unsigned char data;
-  unsigned char usr;
-  unsigned char rx_error;
+  uint16_t available, start, span, copied = 0;
+  uart_index_t head;
 
-  uart = uart_by_name(name);
+  /* Send the first byte directly if the UART is idle */
+  if(count && uart_tx_direct(uart, *buffer))
+    copied = 1;
 
-  /* Read UART status register and UART data register */
-  usr  = *uart->description->registers.status;
-  data = *uart->description->registers.data;
+  head = uart->tx.head;
+  available = copied + uart_tx_free(uart);
+  if(count > available)
+    count = available;
 
-  rx_error = (usr & (uart->description->error_fe | uart->description->error_dor) );
+  while(copied < count)
+  {
+    /* Copy into the free space up to the end of the buffer at most */
+    start = (head + 1) & uart->tx.mask;
+    span = (uint16_t)uart->tx.mask + 1 - start;
+    if(span > count - copied)
+      span = count - copied;
 
-  /* calculate buffer index */
-  tmp_rx_head = ( uart->rx.head + 1) & UART_RX_BUFFER_MASK;
+    memcpy((unsigned char *)&uart->tx.buffer[start], buffer + copied, span);
+    copied += span;
+    head = (head + span) & uart->tx.mask;
+  }
 
-  if ( tmp_rx_head == uart->rx.tail )
+  UART_STATISTIC(uart->statistics.tx_bytes += copied);
+
+  if(head != uart->tx.head)
   {
-    /* error: receive buffer overflow */
-    rx_error = UART_BUFFER_OVERFLOW >> 8;
-  } else {
-    /* store new index */
-    uart->rx.head = tmp_rx_head;
-    /* store received data in buffer */
-    uart->rx.buffer[tmp_rx_head] = data;
+    uart_index_set(&uart->tx.head, head);
+    UART_STATISTIC_PEAK(uart->statistics.tx_peak,
+        head, uart_index_get(&uart->tx.tail), uart->tx.mask);
+
+    /* enable UDRE interrupt */
+    *uart->description->registers.control |= uart->description->control_udrie;
   }
-  uart->rx.error = rx_error;
 
-  if(uart->rx_callback)
-    uart->rx_callback(uart);
+  return copied;
 }
 
-void uart_isr_dre(char *name)
+/*
+ * Queue all count bytes for transmission, waiting for space in the transmit
+ * buffer as necessary.  Returns count.
+ */
+uint16_t uart_write(uart_t *uart, const unsigned char *buffer, uint16_t count)
 {
-  uart_t *uart;
-  unsigned char tmp_tx_tail;
+  uint16_t written;
 
-  uart = uart_by_name(name);
+  written = uart_write_nonblocking(uart, buffer, count);
 
-  if ( uart->tx.head != uart->tx.tail)
+  if(written < count)
   {
-    /* Calculate and store new buffer index */
-    tmp_tx_tail = (uart->tx.tail + 1) & UART_TX_BUFFER_MASK;
-    uart->tx.tail = tmp_tx_tail;
-    /* Get one byte from buffer and write it to UART */
-    *uart->description->registers.data = uart->tx.buffer[tmp_tx_tail];  /* start transmission */
-  } else {
-    /* TX buffer empty, disable UDRE interrupt */
-    *uart->description->registers.control &= ~uart->description->control_udrie;
+    UART_STATISTIC(uart->statistics.tx_waits++);
+    while(written < count)
+    {
+      written += uart_write_nonblocking(uart, buffer + written, count - written);
+    }
   }
+
+  return count;
 }
 
-unsigned char uart_data_ready(uart_t *uart)
+/*
+ * Forward everything received by from to the transmit buffer of to, as it
+ * is pumped by uart_bridge_pump(), or stop forwarding if to is NULL.  The
+ * data is consumed by the bridge unless flags includes UART_BRIDGE_TEE, in
+ * which case it remains to be read from from as usual.
+ */
+void uart_set_bridge(uart_t *from, uart_t *to, uint8_t flags)
 {
-  if (uart->rx.head == uart->rx.tail)
-    return 0;
-  return 1;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    from->bridge.to = to;
+    from->bridge.flags = flags;
+    /* Only forward what is received from now on */
+    from->bridge.tail = from->rx.head;
+    from->bridge.line = from->line.released + from->line.complete;
+    from->bridge.dropped = 0;
+  }
 }
 
-unsigned int uart_getc(uart_t *uart)
+/*
+ * Forward received bytes in byte mode, copying directly from the receive
+ * buffer into the other UART's transmit buffer, in at most two spans.
+ */
+static uint16_t uart_bridge_pump_bytes(uart_t *from)
 {
-  unsigned char tmp_rx_tail, data;
+  uart_index_t head, tail;
+  uint16_t count, start, span, written, forwarded = 0;
 
-  if (uart_data_ready(uart) == 0)
+  head = uart_index_get(&from->rx.head);
+  tail = from->rx.tail;
+
+  if(from->bridge.flags & UART_BRIDGE_TEE)
   {
-    return UART_NO_DATA;   /* no data available */
+    /*
+     * If the application has read past the data not yet forwarded, it may
+     * already have been overwritten, so skip ahead and count it as dropped.
+     */
+    count = (head - from->bridge.tail) & from->rx.mask;
+    if(count > ((head - tail) & from->rx.mask))
+      from->bridge.dropped += (tail - from->bridge.tail) & from->rx.mask;
+    else
+      tail = from->bridge.tail;
   }
 
-  /* Calculate new tail of receive buffer */
-  tmp_rx_tail = (uart->rx.tail + 1) & UART_RX_BUFFER_MASK;
+  count = (head - tail) & from->rx.mask;
 
-  /* Get data from new tail of receive buffer */
-  data = uart->rx.buffer[tmp_rx_tail];
+  while(forwarded < count)
+  {
+    start = (tail + 1) & from->rx.mask;
+    span = (uint16_t)from->rx.mask + 1 - start;
+    if(span > count - forwarded)
+      span = count - forwarded;
 
-  /* Adjust tail pointer, allowing writes into buffer to unblock */
-  uart->rx.tail = tmp_rx_tail;
+    written = uart_write_nonblocking(from->bridge.to,
+        (unsigned char *)&from->rx.buffer[start], span);
+    forwarded += written;
+    tail = (tail + written) & from->rx.mask;
 
-  return (uart->rx.error << 8) + data;
+    /* The other UART has fallen behind, so leave the rest for later */
+    if(written < span)
+      break;
+  }
+
+  if(from->bridge.flags & UART_BRIDGE_TEE)
+  {
+    from->bridge.tail = tail;
+  }
+  else if(forwarded)
+  {
+    uart_index_set(&from->rx.tail, tail);
+    uart_rx_drained(from);
+  }
+
+  return forwarded;
 }
 
-void uart_putc(uart_t *uart, unsigned char data)
+/*
+ * Forward complete lines in line mode.  Only whole lines are written, so
+ * that other output to the same UART can't split them, except for lines
+ * which could never fit in its transmit buffer, which are written blocking.
+ */
+static uint16_t uart_bridge_pump_lines(uart_t *from)
 {
-  unsigned char tmp_tx_head;
+  uint8_t line, slot, behind;
+  uint16_t length, forwarded = 0;
+
+  if(from->bridge.flags & UART_BRIDGE_TEE)
+  {
+    /*
+     * Lines the application has released before they were forwarded.  The
+     * counts wrap, but never differ by more than UART_LINE_SLOTS.
+     */
+    behind = from->line.released - from->bridge.line;
+    if((int8_t)behind > 0)
+    {
+      from->bridge.dropped += behind;
+      from->bridge.line = from->line.released;
+    }
+    line = from->bridge.line;
+  }
+  else
+  {
+    line = from->line.released;
+  }
+
+  while((uint8_t)(line - from->line.released) < from->line.complete)
+  {
+    slot = line & (UART_LINE_SLOTS - 1);
+    length = from->line.length[slot];
+    if(length > uart_tx_free(from->bridge.to) && length <= from->bridge.to->tx.mask)
+      break;
 
-  tmp_tx_head = (uart->tx.head + 1) & UART_TX_BUFFER_MASK;
+    uart_write(from->bridge.to,
+        (unsigned char *)&from->rx.buffer[slot * from->line.slot_size], length);
+    forwarded += length;
 
-  while ( tmp_tx_head == uart->tx.tail ){
-    /* Wait for free space in buffer. */
+    if(from->bridge.flags & UART_BRIDGE_TEE)
+    {
+      from->bridge.line = ++line;
+    }
+    else
+    {
+      uart_line_release(from);
+      line = from->line.released;
+    }
   }
 
-  uart->tx.buffer[tmp_tx_head] = data;
-  uart->tx.head = tmp_tx_head;
+  return forwarded;
+}
 
-  /* enable UDRE interrupt */
-  *uart->description->registers.control |= uart->description->control_udrie;
+/*
+ * Forward as much of the data received by a bridged UART as currently fits
+ * in the other UART's transmit buffer, without blocking.  Call from the idle
+ * loop, and, with UART_BRIDGE_TEE, before reading from the UART, so that the
+ * data is forwarded before it is read.  Returns the number of bytes
+ * forwarded.
+ */
+uint16_t uart_bridge_pump(uart_t *from)
+{
+  if(!from->bridge.to)
+    return 0;
+
+  if(from->line.enabled)
+    return uart_bridge_pump_lines(from);
+
+  return uart_bridge_pump_bytes(from);
 }
 
 void uart_puts(uart_t *uart, const char *s)
 {
-  while (*s)
-    uart_putc(uart, *s++);
+  uart_write(uart, (const unsigned char *)s, strlen(s));
 }
 
 void uart_puts_P(uart_t *uart, const char *progmem_s)
@@ -277,20 +1587,103 @@ void uart_puts_P(uart_t *uart, const char *progmem_s)
     uart_putc(uart, c);
 }
 
+/*
+ * Set up stream as a stdio stream for reading from and writing to uart,
+ * with the newline policy and buffering given by flags (UART_STREAM_CRLF,
+ * UART_STREAM_CR_TO_NL, and UART_STREAM_BUFFERED).  Returns the FILE to use
+ * with stdio functions.
+ */
+FILE *uart_stream_init(uart_stream_t *stream, uart_t *uart, uint8_t flags)
+{
+  stream->uart = uart;
+  stream->flags = flags;
+  stream->length = 0;
+  fdev_setup_stream(&stream->file, uart_putchar, uart_getchar, _FDEV_SETUP_RW);
+
+  return &stream->file;
+}
+
+/*
+ * Write out anything buffered on a stream set up by uart_stream_init(), such
+ * as a prompt without a newline.
+ */
+void uart_stream_flush(FILE *stream)
+{
+  uart_stream_t *s = (uart_stream_t *)stream;
+
+  if(s->length)
+  {
+    uart_write(s->uart, s->buffer, s->length);
+    s->length = 0;
+  }
+}
+
+/*
+ * Use uart for stdin, stdout, and stderr, writing newlines as "\r\n" and
+ * reading carriage returns as newlines.  Output to stdout is buffered until
+ * each newline, or until stdin is read; output to stderr is not.  Anything
+ * written to the UART other than through stdout, such as by uart_putc(),
+ * may overtake a partial line until uart_stream_flush(stdout) is called.
+ */
 void uart_init_stdout(uart_t *uart)
 {
-  uart_stdout.uart = uart;
-  fdev_setup_stream(&uart_stdout.file, uart_putchar, NULL, _FDEV_SETUP_WRITE);
+  uart_stream_init(&uart_stdout, uart,
+      UART_STREAM_CRLF | UART_STREAM_CR_TO_NL | UART_STREAM_BUFFERED);
+  uart_stream_init(&uart_stderr, uart, UART_STREAM_CRLF);
   stdout = &uart_stdout.file;
-  stderr = &uart_stdout.file;
+  stderr = &uart_stderr.file;
+  stdin = &uart_stdout.file;
+}
+
+static inline void uart_stream_put(uart_stream_t *s, unsigned char c)
+{
+  if(s->length == sizeof(s->buffer))
+    uart_stream_flush(&s->file);
+
+  s->buffer[s->length++] = c;
 }
 
 int uart_putchar(char c, FILE *stream)
 {
-  if(c == '\n')
-    uart_putchar('\r', stream);
+  uart_stream_t *s = (uart_stream_t *)stream;
 
-  uart_putc(uart_stdout.uart, c);
+  if(!(s->flags & UART_STREAM_BUFFERED))
+  {
+    /* Don't overtake a partial line on stdout, e.g. with stderr */
+    if(s != &uart_stdout && s->uart == uart_stdout.uart)
+      uart_stream_flush(&uart_stdout.file);
+
+    if(c == '\n' && (s->flags & UART_STREAM_CRLF))
+      uart_putc(s->uart, '\r');
+    uart_putc(s->uart, c);
+
+    return 0;
+  }
+
+  if(c == '\n' && (s->flags & UART_STREAM_CRLF))
+    uart_stream_put(s, '\r');
+
+  uart_stream_put(s, c);
+
+  if(c == '\n')
+    uart_stream_flush(stream);
 
   return 0;
 }
+
+int uart_getchar(FILE *stream)
+{
+  uart_stream_t *s = (uart_stream_t *)stream;
+  unsigned int c;
+
+  /* Make sure any prompt has been seen before waiting for a reply */
+  uart_stream_flush(stream);
+
+  while((c = uart_getc(s->uart)) & UART_NO_DATA)
+    ;
+
+  if((c & 0xff) == '\r' && (s->flags & UART_STREAM_CR_TO_NL))
+    return '\n';
+
+  return c & 0xff;
+}
@@ -50,53 +50,431 @@
 #error "This library requires AVR-GCC 3.4 or later, update to newer AVR-GCC compiler !"
 #endif
 
+/** Default size of the circular receive buffers, must be power of 2 */
+#ifndef UART_RX_BUFFER_SIZE
+#define UART_RX_BUFFER_SIZE 32
+#endif
+
+/** Default size of the circular transmit buffers, must be power of 2 */
+#ifndef UART_TX_BUFFER_SIZE
+#define UART_TX_BUFFER_SIZE 32
+#endif
+
+/*
+ * Size of each UART's RX/TX buffers, defaulting to the sizes above.  These
+ * may be defined individually when building the library, for example to give
+ * a GPS on UART1 a deep receive buffer with -DUART1_RX_BUFFER_SIZE=256.  The
+ * buffers are statically allocated for every UART present on the MCU.
+ */
+#ifndef UART0_RX_BUFFER_SIZE
+#define UART0_RX_BUFFER_SIZE UART_RX_BUFFER_SIZE
+#endif
+#ifndef UART0_TX_BUFFER_SIZE
+#define UART0_TX_BUFFER_SIZE UART_TX_BUFFER_SIZE
+#endif
+#ifndef UART1_RX_BUFFER_SIZE
+#define UART1_RX_BUFFER_SIZE UART_RX_BUFFER_SIZE
+#endif
+#ifndef UART1_TX_BUFFER_SIZE
+#define UART1_TX_BUFFER_SIZE UART_TX_BUFFER_SIZE
+#endif
+#ifndef UART2_RX_BUFFER_SIZE
+#define UART2_RX_BUFFER_SIZE UART_RX_BUFFER_SIZE
+#endif
+#ifndef UART2_TX_BUFFER_SIZE
+#define UART2_TX_BUFFER_SIZE UART_TX_BUFFER_SIZE
+#endif
+#ifndef UART3_RX_BUFFER_SIZE
+#define UART3_RX_BUFFER_SIZE UART_RX_BUFFER_SIZE
+#endif
+#ifndef UART3_TX_BUFFER_SIZE
+#define UART3_TX_BUFFER_SIZE UART_TX_BUFFER_SIZE
+#endif
+
+#define UART_BUFFER_SIZE_VALID(size) \
+  ((size) >= 2 && (size) <= 32768 && !((size) & ((size) - 1)))
+
+#if !UART_BUFFER_SIZE_VALID(UART0_RX_BUFFER_SIZE) \
+  || !UART_BUFFER_SIZE_VALID(UART0_TX_BUFFER_SIZE) \
+  || !UART_BUFFER_SIZE_VALID(UART1_RX_BUFFER_SIZE) \
+  || !UART_BUFFER_SIZE_VALID(UART1_TX_BUFFER_SIZE) \
+  || !UART_BUFFER_SIZE_VALID(UART2_RX_BUFFER_SIZE) \
+  || !UART_BUFFER_SIZE_VALID(UART2_TX_BUFFER_SIZE) \
+  || !UART_BUFFER_SIZE_VALID(UART3_RX_BUFFER_SIZE) \
+  || !UART_BUFFER_SIZE_VALID(UART3_TX_BUFFER_SIZE)
+#error "UART buffer sizes must be a power of two between 2 and 32768!"
+#endif
+
+/* Total size of the buffers for the UARTs actually present */
+#define UART_BUFFER_TOTAL_SIZE ( \
+    (UART0_RX_BUFFER_SIZE + UART0_TX_BUFFER_SIZE) \
+  + ((UART_COUNT > 1) ? (UART1_RX_BUFFER_SIZE + UART1_TX_BUFFER_SIZE) : 0) \
+  + ((UART_COUNT > 2) ? (UART2_RX_BUFFER_SIZE + UART2_TX_BUFFER_SIZE) : 0) \
+  + ((UART_COUNT > 3) ? (UART3_RX_BUFFER_SIZE + UART3_TX_BUFFER_SIZE) : 0) )
+
+/* Test if the size of the circular buffers fits into SRAM */
+#if ( UART_BUFFER_TOTAL_SIZE >= (RAMEND-0x60 ) )
+#error "Total size of UART RX and TX buffers larger than size of SRAM"
+#endif
+
+/*
+ * Buffer indexes are a single byte unless any buffer is larger than 256
+ * bytes.  Wide indexes can't be read or written in a single instruction, so
+ * outside of the ISRs they must be accessed atomically.
+ */
+#if (UART0_RX_BUFFER_SIZE > 256) || (UART0_TX_BUFFER_SIZE > 256) \
+  || (UART1_RX_BUFFER_SIZE > 256) || (UART1_TX_BUFFER_SIZE > 256) \
+  || (UART2_RX_BUFFER_SIZE > 256) || (UART2_TX_BUFFER_SIZE > 256) \
+  || (UART3_RX_BUFFER_SIZE > 256) || (UART3_TX_BUFFER_SIZE > 256)
+#define UART_BUFFER_INDEX_WIDE
+typedef uint16_t uart_index_t;
+#else
+typedef uint8_t uart_index_t;
+#endif
+
+/*
+ * Optionally, timestamp received data with UART_RX_TIMESTAMP_COUNTER, a
+ * free-running counter (defaulting to UART_TIMER_COUNTER) read as each byte
+ * finishes arriving.  With UART_RX_TIMESTAMPS_LINE, each line received in
+ * line mode is stamped with the time of its first byte; with
+ * UART_RX_TIMESTAMPS_BYTE, every byte in the receive buffers is also
+ * stamped, at the cost of a uart_timestamp_t of SRAM per byte of buffer.
+ * UART_RX_TIMESTAMP_TYPE must be wide enough for the counter.
+ */
+#define UART_RX_TIMESTAMPS_NONE 0
+#define UART_RX_TIMESTAMPS_LINE 1
+#define UART_RX_TIMESTAMPS_BYTE 2
+
+#ifndef UART_RX_TIMESTAMPS
+#define UART_RX_TIMESTAMPS UART_RX_TIMESTAMPS_NONE
+#endif
+
+#ifndef UART_RX_TIMESTAMP_TYPE
+#define UART_RX_TIMESTAMP_TYPE uint16_t
+#endif
+
+#if UART_RX_TIMESTAMPS && !defined(UART_RX_TIMESTAMP_COUNTER)
+#if defined(UART_TIMER_COUNTER)
+#define UART_RX_TIMESTAMP_COUNTER UART_TIMER_COUNTER
+#else
+#error "UART_RX_TIMESTAMPS requires UART_RX_TIMESTAMP_COUNTER!"
+#endif
+#endif
+
+typedef UART_RX_TIMESTAMP_TYPE uart_timestamp_t;
+
+/*
+ * The high and low watermarks are used for receive flow control: the peer is
+ * told to stop sending once the buffer fills to the high watermark, and to
+ * resume once it has been read down to the low watermark.
+ */
 typedef struct _uart_buffer_t
 {
   volatile unsigned char *buffer;
-  volatile unsigned char head;
-  volatile unsigned char tail;
+  volatile unsigned char *errors;
+  volatile uart_timestamp_t *timestamps;
+  uart_index_t mask;
+  volatile uart_index_t head;
+  volatile uart_index_t tail;
   volatile unsigned char error;
+  unsigned char read_error;
+  uart_index_t high;
+  uart_index_t low;
 } uart_buffer_t;
 
 
+/*
+ * Tag each byte in the receive buffers with the errors received with it (at
+ * the cost of a byte of SRAM per byte of buffer), so that uart_getc() and
+ * uart_read_error() return the errors for the data read.  If disabled, they
+ * return all of the errors received since data was last read, and clear
+ * them.
+ */
+#ifndef UART_RX_ERROR_TAGGING
+#define UART_RX_ERROR_TAGGING 1
+#endif
+
+/** Number of lines buffered in line mode, must be power of 2 */
+#ifndef UART_LINE_SLOTS
+#define UART_LINE_SLOTS 2
+#endif
+
+#if ( UART_LINE_SLOTS < 2 ) || ( UART_LINE_SLOTS & (UART_LINE_SLOTS - 1) )
+#error "UART_LINE_SLOTS must be a power of two, at least 2!"
+#endif
+
+/*
+ * Line mode state.  In line mode the receive buffer is divided into
+ * UART_LINE_SLOTS equally sized slots, and the RX ISR stores each line
+ * received into its own slot, so that it can be handed to the application
+ * as a single contiguous string.
+ */
+typedef struct _uart_line_t
+{
+  uint8_t enabled;
+  unsigned char delimiter;
+  uint16_t slot_size;
+  uint16_t position;
+  uint8_t discarding;
+  volatile uint8_t fill;
+  volatile uint8_t read;
+  volatile uint8_t complete;
+  uint8_t released;
+  volatile uint16_t length[UART_LINE_SLOTS];
+  volatile uint8_t error[UART_LINE_SLOTS];
+#if UART_RX_TIMESTAMPS
+  volatile uart_timestamp_t timestamp[UART_LINE_SLOTS];
+#endif
+} uart_line_t;
+
+/*
+ * Lifetime counts of receive errors, which saturate rather than wrapping.
+ */
+typedef struct _uart_error_counters_t
+{
+  uint16_t frame;
+  uint16_t overrun;
+  uint16_t overflow;
+} uart_error_counters_t;
+
+/*
+ * Optionally, keep statistics on each UART's use, to show how close its
+ * buffers come to filling up and how long its ISRs take to run.  If
+ * UART_TIMER_COUNTER is defined as a free-running 16-bit counter (e.g. TCNT1
+ * with no prescaler, for cycles), the time spent in each ISR is measured in
+ * its ticks.
+ */
+#ifndef UART_STATISTICS
+#define UART_STATISTICS 0
+#endif
+
+typedef struct _uart_isr_time_t
+{
+  uint32_t total;
+  uint16_t max;
+} uart_isr_time_t;
+
+typedef struct _uart_statistics_t
+{
+  uint32_t rx_bytes;
+  uint32_t tx_bytes;
+  uart_index_t rx_peak;
+  uart_index_t tx_peak;
+  uint16_t tx_waits;
+  uart_isr_time_t rxc_time;
+  uart_isr_time_t dre_time;
+} uart_statistics_t;
+
+/*
+ * A GPIO pin used for flow control, as with lcd_port_t.
+ */
+typedef struct _uart_pin_t
+{
+  volatile uint8_t *pin;
+  volatile uint8_t *port;
+  volatile uint8_t *ddr;
+  uint8_t bv;
+} uart_pin_t;
+
+#define UART_FLOW_NONE        0
+#define UART_FLOW_RTS_CTS     1
+#define UART_FLOW_XON_XOFF    2
+
+#define UART_XON              0x11
+#define UART_XOFF             0x13
+
+/*
+ * Flow control state.  RTS is driven low while we are able to receive, and
+ * CTS is read low while the peer is able to receive; either pin may be
+ * omitted.  With XON/XOFF, a control character to send is held in pending,
+ * and is sent ahead of any buffered data.
+ */
+typedef struct _uart_flow_t
+{
+  uint8_t mode;
+  uart_pin_t *rts;
+  uart_pin_t *cts;
+  volatile uint8_t rx_stopped;
+  volatile uint8_t tx_stopped;
+  volatile unsigned char pending;
+} uart_flow_t;
+
+/** Address of a multiprocessor master, which receives every frame */
+#define UART_MPCM_MASTER      0x00
+/** Address frame selecting every slave */
+#define UART_MPCM_BROADCAST   0xff
+
+/*
+ * Half-duplex (RS-485) state.  While enabled, the TXC interrupt is used to
+ * find the end of each transmission, and the driver enable pin, if any, is
+ * driven high only while transmitting.  In multiprocessor mode, frames are 9
+ * bits, and a slave (with a non-zero address) only receives the data frames
+ * following an address frame carrying its address or UART_MPCM_BROADCAST.
+ */
+typedef struct _uart_rs485_t
+{
+  uint8_t enabled;
+  uart_pin_t *de;
+  volatile uint8_t transmitting;
+  uint8_t multiprocessor;
+  uint8_t address;
+  volatile uint8_t selected;
+} uart_rs485_t;
+
+/** Bridge option: leave the data forwarded to be read locally as well */
+#define UART_BRIDGE_TEE       0x01
+
+/*
+ * Bridging state, for forwarding everything received by one UART to
+ * another's transmit buffer with uart_bridge_pump().  With UART_BRIDGE_TEE,
+ * the position forwarded up to is kept separately from the application's:
+ * tail in byte mode, or line in line mode, which counts lines received (and
+ * wraps) as line.released counts the lines released by the application.
+ * Data which the application has read before it could be forwarded is
+ * counted in dropped, in bytes in byte mode, or in lines in line mode.
+ */
+typedef struct _uart_bridge_t
+{
+  struct _uart_t *to;
+  uint8_t flags;
+  uart_index_t tail;
+  uint8_t line;
+  uint16_t dropped;
+} uart_bridge_t;
+
 typedef struct _uart_t
 {
   uart_description_t *description;
   uart_buffer_t tx;
   uart_buffer_t rx;
+  uart_line_t line;
+  uart_flow_t flow;
+  uart_rs485_t rs485;
+  uart_bridge_t bridge;
+  uart_error_counters_t errors;
+#if UART_STATISTICS
+  uart_statistics_t statistics;
+#endif
+  uint16_t rx_threshold;
+  volatile uint8_t rx_threshold_armed;
+  uint16_t rx_idle_timeout;
+  volatile uint16_t rx_idle_countdown;
   void (*rx_callback)(struct _uart_t *);
+  void (*tx_drained_callback)(struct _uart_t *);
 } uart_t;
 
-typedef struct _uart_stdout_t
-{
-  uart_t *uart;
-  FILE file;
-} uart_stdout_t;
+/** Size of each stream's output buffer */
+#ifndef UART_STREAM_BUFFER_SIZE
+#define UART_STREAM_BUFFER_SIZE 16
+#endif
+
+/** Stream newline policy: write '\n' as "\r\n" */
+#define UART_STREAM_CRLF      0x01
+/** Stream newline policy: read '\r' as '\n', as sent by terminals */
+#define UART_STREAM_CR_TO_NL  0x02
+/** Collect output in the stream's buffer, rather than writing each byte */
+#define UART_STREAM_BUFFERED  0x04
 
-typedef struct _uart_instance_t
+/*
+ * A stdio stream on a UART.  With UART_STREAM_BUFFERED, output is collected
+ * in buffer, and written to the UART's transmit buffer in bulk at each
+ * newline, when buffer fills, before reading from the stream, or by
+ * uart_stream_flush(); otherwise each byte is written as it comes.  Input is
+ * read with uart_getc(), waiting for data, so isn't available in line
+ * mode.  The FILE must be the first member, as uart_putchar() and
+ * uart_getchar() find the stream from it.
+ */
+typedef struct _uart_stream_t
 {
+  FILE file;
   uart_t *uart;
-  struct _uart_instance_t *next;
-} uart_instance_t;
+  uint8_t flags;
+  uint8_t length;
+  unsigned char buffer[UART_STREAM_BUFFER_SIZE];
+} uart_stream_t;
 
-extern uart_instance_t *uart_instances;
-extern uart_stdout_t uart_stdout;
+/*
+ * Initialized UARTs, indexed by UART number.  This allows the ISRs to find
+ * their uart_t in constant time rather than searching by name.
+ */
+extern uart_t *uart_instances[UART_COUNT];
+extern uart_stream_t uart_stdout;
+extern uart_stream_t uart_stderr;
 
 extern uart_t *uart_by_name(char *name);
 extern uart_description_t *uart_description_by_name(char *name);
 
+extern FILE *uart_stream_init(uart_stream_t *stream, uart_t *uart, uint8_t flags);
+extern void uart_stream_flush(FILE *stream);
 extern void uart_init_stdout(uart_t *uart);
 extern int uart_putchar(char c, FILE *stream);
+extern int uart_getchar(FILE *stream);
+
+/*
+ Initialize a UART at baud_rate bps, choosing the UBRR value and U2X
+ setting with the lowest error, or return NULL if no setting is within
+ UART_BAUD_TOLERANCE.
 
-extern uart_t *uart_init(char *name, unsigned int baudrate);
+ Implemented as a macro, which selects the setting at compile time when
+ baud_rate is constant (failing to compile if it is out of tolerance), or
+ calls uart_baud_select() otherwise.
+*/
+extern uart_t *uart_init(char *name, uint32_t baud_rate);
+#define uart_init(name, baud_rate) \
+  (__builtin_constant_p(baud_rate) \
+    ? (UART_BAUD_AUTO((baud_rate), F_CPU) == UART_BAUD_INVALID \
+      ? uart_baud_out_of_tolerance() \
+      : uart_init_ubrr((name), UART_BAUD_AUTO((baud_rate), F_CPU))) \
+    : uart_init_ubrr((name), uart_baud_select((baud_rate), F_CPU)))
+extern uart_t *uart_baud_out_of_tolerance(void)
+  __attribute__((error("baud rate not within UART_BAUD_TOLERANCE at F_CPU")));
+
+extern uart_t *uart_init_ubrr(char *name, unsigned int baudrate);
+extern unsigned int uart_baud_select(uint32_t baud_rate, uint32_t xtal_cpu);
 extern void uart_set_baudrate(uart_t *uart, unsigned int baudrate);
 extern void uart_set_frame_format(uart_t *uart, int frame_format);
 extern void uart_set_rx_callback(uart_t *uart, void (*rx_callback)(uart_t *));
-extern void uart_isr_rxc(char *name);
-extern void uart_isr_dre(char *name);
+extern void uart_set_rx_threshold(uart_t *uart, uint16_t threshold);
+extern void uart_set_rx_idle_timeout(uart_t *uart, uint16_t ticks);
+extern void uart_tick(void);
+extern void uart_set_flow_control(uart_t *uart, uint8_t mode, uart_pin_t *rts, uart_pin_t *cts);
+extern void uart_set_rx_watermarks(uart_t *uart, uint16_t high, uint16_t low);
+extern void uart_flow_cts_changed(uart_t *uart);
+extern void uart_set_rs485(uart_t *uart, uart_pin_t *de);
+extern void uart_set_multiprocessor(uart_t *uart, uint8_t address);
+extern void uart_send_address(uart_t *uart, uint8_t address);
+extern void uart_set_bridge(uart_t *from, uart_t *to, uint8_t flags);
+extern uint16_t uart_bridge_pump(uart_t *from);
+extern void uart_set_tx_drained_callback(uart_t *uart, void (*tx_drained_callback)(uart_t *));
+extern void uart_isr_rxc(uart_t *uart);
+extern void uart_isr_dre(uart_t *uart);
+extern void uart_isr_txc(uart_t *uart);
 extern unsigned char uart_data_ready(uart_t *uart);
 extern unsigned int uart_getc(uart_t *uart);
+extern unsigned int uart_peek(uart_t *uart);
+extern uint16_t uart_read(uart_t *uart, unsigned char *buffer, uint16_t count);
+extern uint16_t uart_read_until(uart_t *uart, unsigned char *buffer, uint16_t count, unsigned char delimiter);
+extern unsigned int uart_read_error(uart_t *uart);
+extern uint16_t uart_set_line_mode(uart_t *uart, unsigned char delimiter);
+extern char *uart_line_get(uart_t *uart, uint16_t *length);
+extern unsigned int uart_line_error(uart_t *uart);
+#if UART_RX_TIMESTAMPS
+extern uart_timestamp_t uart_line_timestamp(uart_t *uart);
+#endif
+#if UART_RX_TIMESTAMPS == UART_RX_TIMESTAMPS_BYTE
+extern uart_timestamp_t uart_rx_timestamp(uart_t *uart);
+#endif
+extern void uart_line_release(uart_t *uart);
+extern void uart_get_error_counters(uart_t *uart, uart_error_counters_t *counters);
+extern void uart_reset_error_counters(uart_t *uart);
+#if UART_STATISTICS
+extern void uart_get_statistics(uart_t *uart, uart_statistics_t *statistics);
+extern void uart_reset_statistics(uart_t *uart);
+#endif
 extern void uart_putc(uart_t *uart, unsigned char data);
+extern uint16_t uart_tx_free(uart_t *uart);
+extern uint16_t uart_write(uart_t *uart, const unsigned char *buffer, uint16_t count);
+extern uint16_t uart_write_nonblocking(uart_t *uart, const unsigned char *buffer, uint16_t count);
 extern void uart_puts(uart_t *uart, const char *s);
 extern void uart_puts_P(uart_t *uart, const char *progmem_s);
 
@@ -109,6 +487,14 @@ extern void uart_puts_P(uart_t *uart, const char *progmem_s);
  */
 #define UART_BAUD_RATE_2X     0x8000
 
+/** @brief  Number of uart_tick() calls spanning a number of character times
+ *  @param  characters  idle time in characters (8N1, 10 bits each)
+ *  @param  baud_rate   baudrate in bps, e.g. 1200, 2400, 9600
+ *  @param  tick_hz     rate at which uart_tick() is called, e.g. 1000
+ */
+#define UART_IDLE_TICKS(characters, baud_rate, tick_hz) \
+  ((uint16_t)(((characters) * 10l * (tick_hz) + (baud_rate) - 1) / (baud_rate)))
+
 /** @brief  UART Baudrate Expression
  *  @param  xtalcpu  system clock in Mhz, e.g. 4000000L for 4Mhz          
  *  @param  baudrate baudrate in bps, e.g. 1200, 2400, 9600     
@@ -123,28 +509,61 @@ extern void uart_puts_P(uart_t *uart, const char *progmem_s);
 #define UART_BAUD_SELECT_DOUBLE_SPEED(baud_rate, xtal_cpu) \
   (((xtal_cpu) / ((baud_rate) * 8l) - 1) | UART_BAUD_RATE_2X)
 
+/** Largest baud rate error accepted by uart_init(), in tenths of a percent */
+#ifndef UART_BAUD_TOLERANCE
+#define UART_BAUD_TOLERANCE 20
+#endif
 
-/** Default size of the circular receive buffers, must be power of 2 */
-#define UART_RX_BUFFER_SIZE 32
+/** Returned by UART_BAUD_AUTO() if no setting is within tolerance */
+#define UART_BAUD_INVALID     0xffff
 
-/** Default size of the circular transmit buffers, must be power of 2 */
-#define UART_TX_BUFFER_SIZE 32
+/** Largest UBRR value, as UBRRH holds only 4 bits */
+#define UART_UBRR_MAX         4095
 
-/* size of RX/TX buffers */
-#define UART_RX_BUFFER_MASK  ( UART_RX_BUFFER_SIZE - 1)
-#define UART_TX_BUFFER_MASK  ( UART_TX_BUFFER_SIZE - 1)
+/** @brief  UBRR for baud_rate rounded to nearest, with 16 (normal) or 8
+ *          (double speed) samples per bit
+ */
+#define UART_BAUD_UBRR(baud_rate, xtal_cpu, samples) \
+  (((uint32_t)(xtal_cpu) + (uint32_t)(samples) / 2 * (baud_rate)) \
+    / ((uint32_t)(samples) * (baud_rate)) - 1)
 
-#if ( UART_RX_BUFFER_SIZE & UART_RX_BUFFER_MASK )
-#error "UART_RX_BUFFER_SIZE must be a power of two!"
-#endif
-#if ( UART_TX_BUFFER_SIZE & UART_TX_BUFFER_MASK )
-#error "UART_TX_BUFFER_SIZE must be a power of two!"
-#endif
+/** @brief  Baud rate error using UART_BAUD_UBRR(), in tenths of a percent,
+ *          or 1000 if the UBRR is out of range or the error over 6.25%
+ */
+#define UART_BAUD_CLOCKS(baud_rate, xtal_cpu, samples) \
+  ((uint32_t)(samples) * (baud_rate) \
+    * (UART_BAUD_UBRR((baud_rate), (xtal_cpu), (samples)) + 1))
+
+#define UART_BAUD_DIFFERENCE(baud_rate, xtal_cpu, samples) \
+  ((uint32_t)(xtal_cpu) > UART_BAUD_CLOCKS((baud_rate), (xtal_cpu), (samples)) \
+    ? (uint32_t)(xtal_cpu) - UART_BAUD_CLOCKS((baud_rate), (xtal_cpu), (samples)) \
+    : UART_BAUD_CLOCKS((baud_rate), (xtal_cpu), (samples)) - (uint32_t)(xtal_cpu))
+
+#define UART_BAUD_ERROR(baud_rate, xtal_cpu, samples) \
+  ((UART_BAUD_UBRR((baud_rate), (xtal_cpu), (samples)) > UART_UBRR_MAX \
+    || UART_BAUD_DIFFERENCE((baud_rate), (xtal_cpu), (samples)) \
+      > UART_BAUD_CLOCKS((baud_rate), (xtal_cpu), (samples)) / 16) \
+    ? 1000 \
+    : UART_BAUD_DIFFERENCE((baud_rate), (xtal_cpu), (samples)) * 1000 \
+      / UART_BAUD_CLOCKS((baud_rate), (xtal_cpu), (samples)))
+
+/** @brief  UART Baudrate Expression choosing normal or double speed,
+ *          whichever has the lower error, or UART_BAUD_INVALID if neither
+ *          is within UART_BAUD_TOLERANCE.  Normal speed is preferred when
+ *          equal, as it samples each bit more often.
+ *  @param  baud_rate baudrate in bps, e.g. 1200, 2400, 9600
+ *  @param  xtal_cpu  system clock in Hz, e.g. 4000000L for 4Mhz
+ */
+#define UART_BAUD_AUTO(baud_rate, xtal_cpu) \
+  ((unsigned int)(UART_BAUD_ERROR((baud_rate), (xtal_cpu), 8) \
+      < UART_BAUD_ERROR((baud_rate), (xtal_cpu), 16) \
+    ? (UART_BAUD_ERROR((baud_rate), (xtal_cpu), 8) > UART_BAUD_TOLERANCE \
+      ? UART_BAUD_INVALID \
+      : UART_BAUD_UBRR((baud_rate), (xtal_cpu), 8) | UART_BAUD_RATE_2X) \
+    : (UART_BAUD_ERROR((baud_rate), (xtal_cpu), 16) > UART_BAUD_TOLERANCE \
+      ? UART_BAUD_INVALID \
+      : UART_BAUD_UBRR((baud_rate), (xtal_cpu), 16))))
 
-/* Test if the size of the circular buffers fits into SRAM */
-#if ( (UART_RX_BUFFER_SIZE+UART_TX_BUFFER_SIZE) >= (RAMEND-0x60 ) )
-#error "Size of UART_RX_BUFFER_SIZE + UART_TX_BUFFER_SIZE larger than size of SRAM"
-#endif
 
 /* 
 ** High byte error return code of uart_getc()
@@ -38,10 +38,16 @@
       (_BV(RXCIE##suffix) | _BV(RXEN##suffix)| _BV(TXEN##suffix)), \
       _BV(UDRIE##suffix), \
       _BV(U2X##suffix), \
+      _BV(UDRE##suffix), \
       0, \
       (_BV(UCSZ##suffix##1) | _BV(UCSZ##suffix##0)), \
       _BV(FE##suffix), \
-      _BV(DOR##suffix) \
+      _BV(DOR##suffix), \
+      _BV(TXCIE##suffix), \
+      _BV(UCSZ##suffix##2), \
+      _BV(TXB8##suffix), \
+      _BV(RXB8##suffix), \
+      _BV(MPCM##suffix) \
     }
 
 
@@ -60,10 +66,16 @@ uart_description_t uart_descriptions[] = {
       UART0_ENABLE,
       UART0_UDRIE,
       UART0_U2X,
+      UART0_UDRE,
       0,
       UART0_FORMAT_8N1,
       UART0_ERROR_FE,
-      UART0_ERROR_DOR
+      UART0_ERROR_DOR,
+      UART0_TXCIE,
+      UART0_UCSZ2,
+      UART0_TXB8,
+      UART0_RXB8,
+      UART0_MPCM
     },
 #endif
 
@@ -79,6 +91,7 @@ uart_description_t uart_descriptions[] = {
     UARTX_DESCRIPTION("3", 3),
 #endif
 
-    { NULL, {NULL, NULL, NULL, NULL, NULL, NULL}, 0, 0, 0, 0, 0, 0 }
+    { NULL, {NULL, NULL, NULL, NULL, NULL, NULL}, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0 }
 };
 
@@ -22,6 +22,21 @@
 #include <inttypes.h>
 #include <avr/io.h>
 
+/*
+ * The number of UARTs described in uart_descriptions[], which is also the
+ * size of the uart_instances[] table.  The descriptions are populated in
+ * order, so a UART's index in either array is its number.
+ */
+#if defined(UDRIE3)
+#define UART_COUNT 4
+#elif defined(UDRIE2)
+#define UART_COUNT 3
+#elif defined(UDRIE1)
+#define UART_COUNT 2
+#else
+#define UART_COUNT 1
+#endif
+
 typedef struct _uart_registers_t
 {
   volatile uint8_t *status;
@@ -39,10 +54,16 @@ typedef struct _uart_description_t
   uint8_t control_enable;
   uint8_t control_udrie;
   uint8_t status_u2x;
+  uint8_t status_udre;
   uint8_t format_async;
   uint8_t format_8n1;
   uint8_t error_fe;
   uint8_t error_dor;
+  uint8_t control_txcie;
+  uint8_t control_ucsz2;
+  uint8_t control_txb8;
+  uint8_t control_rxb8;
+  uint8_t status_mpcm;
 } uart_description_t;
 
 
@@ -0,0 +1,174 @@
+/*
+    Copyright (c) 2010, Jeremy Cole <jeremy@jcole.us>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#include <stdlib.h>
+#include <inttypes.h>
+#include <util/atomic.h>
+
+#include "uart.h"
+#include "uart_log.h"
+
+uart_log_t uart_log;
+
+/*
+ * Start logging into buffer, of size bytes, which must be a power of 2.
+ */
+void uart_log_init(unsigned char *buffer, uint16_t size)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    uart_log.buffer = buffer;
+    uart_log.mask = size - 1;
+    uart_log.head = 0;
+    uart_log.tail = 0;
+    uart_log.dropped = 0;
+    uart_log.dropped_total = 0;
+  }
+}
+
+/*
+ * Append bytes to the log ring at *head, updating *checksum.
+ */
+static inline void uart_log_append(uint16_t *head, uint8_t *checksum,
+    const unsigned char *data, uint8_t length)
+{
+  while(length--)
+  {
+    *checksum ^= *data;
+    uart_log.buffer[*head] = *data++;
+    *head = (*head + 1) & uart_log.mask;
+  }
+}
+
+/*
+ * Append a complete frame to the log ring at *head.
+ */
+static void uart_log_frame(uint16_t *head, uint16_t id,
+    const void *arguments, uint8_t length)
+{
+  unsigned char header[UART_LOG_FRAME_HEADER - 1];
+  uint8_t checksum = 0;
+
+  header[0] = id & 0xff;
+  header[1] = id >> 8;
+  header[2] = length;
+
+  uart_log.buffer[*head] = UART_LOG_FRAME_START;
+  *head = (*head + 1) & uart_log.mask;
+  uart_log_append(head, &checksum, header, sizeof(header));
+  uart_log_append(head, &checksum, arguments, length);
+
+  uart_log.buffer[*head] = checksum;
+  *head = (*head + 1) & uart_log.mask;
+}
+
+/*
+ * Record a log frame for format_P (in flash) and its raw arguments; normally
+ * called through UART_LOG().  If the ring doesn't have room for the frame,
+ * it is dropped and counted.  Once there is room again, the number dropped
+ * is logged ahead of the next frame.
+ */
+void uart_log_write(const char *format_P, const void *arguments, uint8_t length)
+{
+  uint16_t head, available;
+  uint8_t needed;
+
+  needed = UART_LOG_FRAME_HEADER + length + UART_LOG_FRAME_TRAILER;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    head = uart_log.head;
+    available = (uart_log.tail - head - 1) & uart_log.mask;
+
+    if(uart_log.dropped)
+    {
+      if(available < needed + UART_LOG_FRAME_HEADER + 2 + UART_LOG_FRAME_TRAILER)
+      {
+        uart_log.dropped++;
+        uart_log.dropped_total++;
+        return;
+      }
+
+      uart_log_frame(&head, UART_LOG_ID_DROPPED,
+          &uart_log.dropped, sizeof(uart_log.dropped));
+      uart_log.dropped = 0;
+    }
+    else if(available < needed)
+    {
+      uart_log.dropped++;
+      uart_log.dropped_total++;
+      return;
+    }
+
+    uart_log_frame(&head, (uint16_t)(uintptr_t)format_P, arguments, length);
+    uart_log.head = head;
+  }
+}
+
+/*
+ * Send as many whole frames from the log ring as currently fit in the UART's
+ * transmit buffer, without blocking.  Only whole frames are sent, so that
+ * other output to the same UART can't split them.  Call from the idle loop.
+ * Returns 1 if anything remains to be sent.
+ */
+uint8_t uart_log_flush(uart_t *uart)
+{
+  uint16_t head, tail;
+  uint16_t available, length, span;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    head = uart_log.head;
+  }
+  tail = uart_log.tail;
+  available = uart_tx_free(uart);
+
+  while(tail != head)
+  {
+    length = UART_LOG_FRAME_HEADER
+      + uart_log.buffer[(tail + UART_LOG_FRAME_HEADER - 1) & uart_log.mask]
+      + UART_LOG_FRAME_TRAILER;
+
+    /*
+     * Wait for room for the frame, unless it could never fit in the
+     * transmit buffer, in which case it must be written blocking.
+     */
+    if(length > available && length <= uart->tx.mask)
+      break;
+    available -= (length > available) ? available : length;
+
+    /* Send the frame in up to two spans, before and after the end of ring */
+    span = uart_log.mask + 1 - tail;
+    if(span > length)
+      span = length;
+
+    uart_write(uart, &uart_log.buffer[tail], span);
+    if(span < length)
+      uart_write(uart, &uart_log.buffer[0], length - span);
+
+    tail = (tail + length) & uart_log.mask;
+  }
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    uart_log.tail = tail;
+  }
+
+  return tail != head;
+}
@@ -0,0 +1,139 @@
+/*
+    Copyright (c) 2010, Jeremy Cole <jeremy@jcole.us>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+#ifndef UART_LOG_H
+#define UART_LOG_H
+
+#include <inttypes.h>
+#include <avr/pgmspace.h>
+
+#include "uart.h"
+
+/*
+ * Deferred binary logging.  UART_LOG() records a printf-style format and its
+ * arguments without formatting them: the format string is kept in flash and
+ * identified by its address, and the arguments are copied raw into a RAM
+ * ring as a complete frame.  uart_log_flush(), called from the idle loop,
+ * sends the frames without blocking, and uart_log_decode.py rebuilds the
+ * text on the host using the format strings in the application's ELF file.
+ *
+ * Each frame is:
+ *
+ *   UART_LOG_FRAME_START, id (2 bytes, little-endian), length, arguments,
+ *   checksum (XOR of id, length, and arguments)
+ *
+ * Arguments are stored as printf would receive them (char and short as int,
+ * float as double, which are 2 and 4 bytes on AVR), so the decoder can size
+ * them from the format alone.  Since only the argument's value is recorded,
+ * strings in RAM (%s) can't be logged; log an index or number instead.
+ * Strings in flash (%S) can be, as the decoder reads them from the ELF file.
+ *
+ * The ring is provided by the application with uart_log_init(), and its size
+ * must be a power of 2; until then, everything logged is dropped.
+ *
+ * UART_LOG() may be used in ISRs.  Frames which don't fit in the ring are
+ * dropped and counted, and reported in a frame with UART_LOG_ID_DROPPED.
+ */
+
+/*
+ * A frame identifies its format by the format's 16-bit address in flash, so
+ * formats beyond the first 64 KB couldn't be identified.
+ */
+#if defined(FLASHEND) && FLASHEND > 0xffff
+#error "uart_log requires an MCU with at most 64 KB of flash!"
+#endif
+
+#define UART_LOG_FRAME_START   0x7e
+#define UART_LOG_FRAME_HEADER  4
+#define UART_LOG_FRAME_TRAILER 1
+
+/** Id of the frame reporting dropped frames, with a 2-byte count */
+#define UART_LOG_ID_DROPPED    0x0000
+
+typedef struct _uart_log_t
+{
+  unsigned char *buffer;
+  uint16_t mask;
+  volatile uint16_t head, tail;
+  uint16_t dropped;
+  uint16_t dropped_total;
+} uart_log_t;
+
+extern uart_log_t uart_log;
+
+extern void uart_log_init(unsigned char *buffer, uint16_t size);
+extern void uart_log_write(const char *format_P, const void *arguments, uint8_t length);
+extern uint8_t uart_log_flush(uart_t *uart);
+
+/*
+ * Count the arguments to UART_LOG(), and dispatch to UART_LOG_<count>.
+ * Up to 8 arguments after the format are supported.
+ */
+#define UART_LOG_COUNT(...) \
+  UART_LOG_COUNT_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0, _)
+#define UART_LOG_COUNT_(f, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+#define UART_LOG_CAT(a, b) UART_LOG_CAT_(a, b)
+#define UART_LOG_CAT_(a, b) a##b
+
+/** Log format (a string literal) with up to 8 arguments */
+#define UART_LOG(...) \
+  UART_LOG_CAT(UART_LOG_, UART_LOG_COUNT(__VA_ARGS__))(__VA_ARGS__)
+
+/* The promoted type of each argument, as printf would receive it */
+#define UART_LOG_T(a) __typeof__((a) + 0)
+
+#define UART_LOG_RECORD(format, type, ...) \
+  do { \
+    static const char uart_log_format[] PROGMEM = format; \
+    uart_log_write(uart_log_format, &(type){ __VA_ARGS__ }, sizeof(type)); \
+  } while(0)
+
+#define UART_LOG_0(format) \
+  do { \
+    static const char uart_log_format[] PROGMEM = format; \
+    uart_log_write(uart_log_format, NULL, 0); \
+  } while(0)
+
+#define UART_LOG_1(format, a) \
+  UART_LOG_RECORD(format, struct { UART_LOG_T(a) _a; }, a)
+#define UART_LOG_2(format, a, b) \
+  UART_LOG_RECORD(format, struct { UART_LOG_T(a) _a; UART_LOG_T(b) _b; }, a, b)
+#define UART_LOG_3(format, a, b, c) \
+  UART_LOG_RECORD(format, struct { UART_LOG_T(a) _a; UART_LOG_T(b) _b; \
+    UART_LOG_T(c) _c; }, a, b, c)
+#define UART_LOG_4(format, a, b, c, d) \
+  UART_LOG_RECORD(format, struct { UART_LOG_T(a) _a; UART_LOG_T(b) _b; \
+    UART_LOG_T(c) _c; UART_LOG_T(d) _d; }, a, b, c, d)
+#define UART_LOG_5(format, a, b, c, d, e) \
+  UART_LOG_RECORD(format, struct { UART_LOG_T(a) _a; UART_LOG_T(b) _b; \
+    UART_LOG_T(c) _c; UART_LOG_T(d) _d; UART_LOG_T(e) _e; }, a, b, c, d, e)
+#define UART_LOG_6(format, a, b, c, d, e, f) \
+  UART_LOG_RECORD(format, struct { UART_LOG_T(a) _a; UART_LOG_T(b) _b; \
+    UART_LOG_T(c) _c; UART_LOG_T(d) _d; UART_LOG_T(e) _e; \
+    UART_LOG_T(f) _f; }, a, b, c, d, e, f)
+#define UART_LOG_7(format, a, b, c, d, e, f, g) \
+  UART_LOG_RECORD(format, struct { UART_LOG_T(a) _a; UART_LOG_T(b) _b; \
+    UART_LOG_T(c) _c; UART_LOG_T(d) _d; UART_LOG_T(e) _e; \
+    UART_LOG_T(f) _f; UART_LOG_T(g) _g; }, a, b, c, d, e, f, g)
+#define UART_LOG_8(format, a, b, c, d, e, f, g, h) \
+  UART_LOG_RECORD(format, struct { UART_LOG_T(a) _a; UART_LOG_T(b) _b; \
+    UART_LOG_T(c) _c; UART_LOG_T(d) _d; UART_LOG_T(e) _e; \
+    UART_LOG_T(f) _f; UART_LOG_T(g) _g; UART_LOG_T(h) _h; }, \
+    a, b, c, d, e, f, g, h)
+
+#endif /* UART_LOG_H */
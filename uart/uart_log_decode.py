@@ -0,0 +1,223 @@
+#!/usr/bin/env python3
+#
+#   Copyright (c) 2010, Jeremy Cole <jeremy@jcole.us>
+#
+#   This program is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation; either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program; if not, write to the Free Software
+#   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+"""Decode UART_LOG() frames from a serial console.
+
+Reads the console output of an application using uart_log (from a file, or
+standard input, e.g. a serial port), and prints it with each binary log
+frame replaced by its text, formatted using the format strings in the
+application's ELF file.  Anything outside of a frame is passed through.
+
+  uart_log_decode.py led_analog_clock.elf < /dev/ttyUSB0
+"""
+
+import os
+import re
+import struct
+import sys
+
+FRAME_START = 0x7E
+FRAME_HEADER = 4
+FRAME_TRAILER = 1
+ID_DROPPED = 0x0000
+
+# Sizes of printf arguments on AVR, after promotion.
+SIZE_INT = 2
+SIZE_LONG = 4
+SIZE_LONG_LONG = 8
+SIZE_DOUBLE = 4
+SIZE_POINTER = 2
+
+CONVERSION = re.compile(
+    r"%(?P<flags>[-+ #0]*)(?P<width>\*|\d+)?(?:\.(?P<precision>\*|\d+))?"
+    r"(?P<length>hh|h|ll|l|z|t|j)?(?P<type>[diouxXcsSpfFeEgGaA%])")
+
+
+class Elf(object):
+  """The allocated sections of an ELF32 file, to look up strings by address."""
+
+  def __init__(self, path):
+    with open(path, "rb") as f:
+      data = f.read()
+    if data[:4] != b"\x7fELF" or data[4] != 1:
+      raise ValueError("%s: not an ELF32 file" % path)
+    endian = "<" if data[5] == 1 else ">"
+    (shoff,) = struct.unpack_from(endian + "I", data, 0x20)
+    shentsize, shnum = struct.unpack_from(endian + "HH", data, 0x2E)
+    self.sections = []
+    for i in range(shnum):
+      (_, sh_type, sh_flags, sh_addr, sh_offset, sh_size) = struct.unpack_from(
+          endian + "IIIIII", data, shoff + i * shentsize)
+      # SHT_PROGBITS sections with SHF_ALLOC, i.e. flash contents
+      if sh_type == 1 and sh_flags & 0x2:
+        self.sections.append(
+            (sh_addr, data[sh_offset:sh_offset + sh_size]))
+
+  def string(self, address):
+    for (start, contents) in self.sections:
+      if start <= address < start + len(contents):
+        end = contents.find(b"\0", address - start)
+        if end < 0:
+          return None
+        return contents[address - start:end].decode("latin-1")
+    return None
+
+
+def argument(arguments, offset, size, fmt):
+  value = arguments[offset:offset + size]
+  if len(value) < size:
+    raise ValueError("frame too short for its format")
+  return struct.unpack("<" + fmt, value)[0], offset + size
+
+
+def format_frame(elf, id, arguments):
+  """Format one frame's arguments with the format string at flash address id."""
+  if id == ID_DROPPED:
+    (dropped,) = struct.unpack_from("<H", arguments)
+    return "[uart_log: %u frames dropped]\n" % dropped
+
+  format = elf.string(id)
+  if format is None:
+    return None
+
+  offset = 0
+  output = []
+  last = 0
+  for conversion in CONVERSION.finditer(format):
+    output.append(format[last:conversion.start()])
+    last = conversion.end()
+    spec = conversion.group("flags")
+    type = conversion.group("type")
+    length = conversion.group("length") or ""
+
+    if type == "%":
+      output.append("%")
+      continue
+
+    for part in ("width", "precision"):
+      value = conversion.group(part)
+      if value == "*":
+        value, offset = argument(arguments, offset, SIZE_INT, "h")
+      if value is not None:
+        spec += ("." if part == "precision" else "") + str(value)
+
+    if type in "fFeEgGaA":
+      value, offset = argument(arguments, offset, SIZE_DOUBLE, "f")
+    elif type in "sSp":
+      value, offset = argument(arguments, offset, SIZE_POINTER, "H")
+      if type == "S":
+        # A string in flash, which can be read from the ELF file.
+        value = elf.string(value)
+        if value is None:
+          value = "<flash string>"
+      elif type == "s":
+        value = "<0x%04x>" % value
+      else:
+        value = "0x%x" % value
+      type = "s"
+    else:
+      size = {"ll": SIZE_LONG_LONG, "l": SIZE_LONG}.get(length, SIZE_INT)
+      fmt = {2: "h", 4: "i", 8: "q"}[size]
+      if type not in "dic":
+        fmt = fmt.upper()
+      value, offset = argument(arguments, offset, size, fmt)
+      if length == "hh":
+        value = (value & 0xFF) - (0x100 if type in "di" and value & 0x80 else 0)
+      if type == "c":
+        value = chr(value & 0xFF)
+      if type == "u":
+        type = "d"
+
+    output.append(("%" + spec + type) % value)
+
+  output.append(format[last:])
+  return "".join(output)
+
+
+def decode(elf, buffer, out, final=False):
+  """Decode and write out buffer, returning any incomplete frame at its end."""
+  text_start = 0
+  position = 0
+  while True:
+    position = buffer.find(bytes([FRAME_START]), position)
+    if position < 0:
+      break
+
+    header = buffer[position + 1:position + FRAME_HEADER]
+    if len(header) < FRAME_HEADER - 1:
+      if final:
+        break
+      out.write(buffer[text_start:position].decode("latin-1"))
+      return buffer[position:]
+
+    id = header[0] | header[1] << 8
+    length = header[2]
+    end = position + FRAME_HEADER + length + FRAME_TRAILER
+    if end > len(buffer):
+      if final:
+        break
+      out.write(buffer[text_start:position].decode("latin-1"))
+      return buffer[position:]
+
+    checksum = 0
+    for byte in buffer[position + 1:end]:
+      checksum ^= byte
+
+    text = None
+    if checksum == 0:
+      try:
+        text = format_frame(elf, id, buffer[position + FRAME_HEADER:end - 1])
+      except (ValueError, TypeError, struct.error):
+        text = None
+
+    if text is None:
+      # Not a valid frame, so pass the start byte through as text.
+      position += 1
+      continue
+
+    out.write(buffer[text_start:position].decode("latin-1"))
+    out.write(text)
+    position = end
+    text_start = end
+
+  out.write(buffer[text_start:].decode("latin-1"))
+  return b""
+
+
+def main(argv):
+  if len(argv) not in (2, 3):
+    sys.stderr.write("usage: %s <elf file> [<console capture>]\n" % argv[0])
+    return 1
+
+  elf = Elf(argv[1])
+  fd = os.open(argv[2], os.O_RDONLY) if len(argv) == 3 else sys.stdin.fileno()
+
+  pending = b""
+  while True:
+    data = os.read(fd, 4096)
+    if not data:
+      break
+    pending = decode(elf, pending + data, sys.stdout)
+    sys.stdout.flush()
+
+  decode(elf, pending, sys.stdout, final=True)
+  return 0
+
+
+if __name__ == "__main__":
+  sys.exit(main(sys.argv))
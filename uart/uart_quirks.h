@@ -47,10 +47,16 @@
 #undef  UART0_UBRRH
 #define UART0_UDRIE     _BV(UDRIE)
 #undef  UART0_U2X
+#define UART0_UDRE      _BV(UDRE)
 #undef  UART0_ENABLE
 #define UART0_FORMAT_8N1 (_BV(UCSZ01) | _BV(UCSZ00))
 #define UART0_ERROR_FE  _BV(FE)
 #define UART0_ERROR_DOR _BV(DOR)
+#define UART0_TXCIE     _BV(TXCIE)
+#define UART0_UCSZ2     _BV(CHR9)
+#define UART0_TXB8      _BV(TXB8)
+#define UART0_RXB8      _BV(RXB8)
+#define UART0_MPCM      0
 
 /*
  * Old AVR AT90 classic with one UART.
@@ -72,10 +78,16 @@
 #undef  UART0_UBRRH
 #define UART0_UDRIE     _BV(UDRIE)
 #undef  UART0_U2X
+#define UART0_UDRE      _BV(UDRE)
 #undef  UART0_ENABLE
 #define UART0_FORMAT_8N1 (_BV(UCSZ1) | _BV(UCSZ0))
 #define UART0_ERROR_FE  _BV(FE)
 #define UART0_ERROR_DOR _BV(DOR)
+#define UART0_TXCIE     _BV(TXCIE)
+#define UART0_UCSZ2     _BV(CHR9)
+#define UART0_TXB8      _BV(TXB8)
+#define UART0_RXB8      _BV(RXB8)
+#define UART0_MPCM      _BV(MPCM)
 
 /* ATmega with one UART/USART
  * - Status/Control Registers: Combined A/B
@@ -109,10 +121,16 @@
 #endif
 #define UART0_UDRIE     _BV(UDRIE)
 #define UART0_U2X       _BV(U2X)
+#define UART0_UDRE      _BV(UDRE)
 #define UART0_ENABLE    (_BV(RXCIE) | _BV(RXEN)| _BV(TXEN))
 #define UART0_FORMAT_8N1 (_BV(UCSZ1) | _BV(UCSZ0))
 #define UART0_ERROR_FE  _BV(FE)
 #define UART0_ERROR_DOR _BV(DOR)
+#define UART0_TXCIE     _BV(TXCIE)
+#define UART0_UCSZ2     _BV(UCSZ2)
+#define UART0_TXB8      _BV(TXB8)
+#define UART0_RXB8      _BV(RXB8)
+#define UART0_MPCM      _BV(MPCM)
 
 /* ATmega with one USART
  * - Status/Control Registers: Combined A/B
@@ -143,10 +161,16 @@
 #define UART0_UBRRH     UBRR0H
 #define UART0_UDRIE     _BV(UDRIE0)
 #define UART0_U2X       _BV(U2X0)
+#define UART0_UDRE      _BV(UDRE0)
 #define UART0_ENABLE    (_BV(RXCIE0) | _BV(RXEN0)| _BV(TXEN0))
 #define UART0_FORMAT_8N1 (_BV(UCSZ01) | _BV(UCSZ00))
 #define UART0_ERROR_FE  _BV(FE0)
 #define UART0_ERROR_DOR _BV(DOR0)
+#define UART0_TXCIE     _BV(TXCIE0)
+#define UART0_UCSZ2     _BV(UCSZ02)
+#define UART0_TXB8      _BV(TXB80)
+#define UART0_RXB8      _BV(RXB80)
+#define UART0_MPCM      _BV(MPCM0)
 
 /* ATmega with two USART */
 #elif defined(__AVR_ATmega162__) \
@@ -171,10 +195,16 @@
 #define UART0_UBRRH     UBRR0H
 #define UART0_UDRIE     _BV(UDRIE0)
 #define UART0_U2X       _BV(U2X0)
+#define UART0_UDRE      _BV(UDRE0)
 #define UART0_ENABLE    (_BV(RXCIE0) | _BV(RXEN0)| _BV(TXEN0))
 #define UART0_FORMAT_8N1 (_BV(UCSZ01) | _BV(UCSZ00))
 #define UART0_ERROR_FE  _BV(FE0)
 #define UART0_ERROR_DOR _BV(DOR0)
+#define UART0_TXCIE     _BV(TXCIE0)
+#define UART0_UCSZ2     _BV(UCSZ02)
+#define UART0_TXB8      _BV(TXB80)
+#define UART0_RXB8      _BV(RXB80)
+#define UART0_MPCM      _BV(MPCM0)
 
 #else
 #error "No UART definition for MCU available"
@@ -218,4 +248,81 @@
 #endif
 #endif
 
+/*
+ * Additional USARTs 1-3, which always have numeric suffixes on both their
+ * registers and ISRs.  These are given the same UARTn_* names as UART0 so
+ * that code can be generated for any UART by number.
+ */
+#if defined(UDRIE1)
+#define UART1_RXC_INT   USART1_RX_vect
+#define UART1_TXC_INT   USART1_TX_vect
+#define UART1_DRE_INT   USART1_UDRE_vect
+#define UART1_STATUS    UCSR1A
+#define UART1_CONTROL   UCSR1B
+#define UART1_FORMAT    UCSR1C
+#define UART1_DATA      UDR1
+#define UART1_UBRRL     UBRR1L
+#define UART1_UBRRH     UBRR1H
+#define UART1_UDRIE     _BV(UDRIE1)
+#define UART1_U2X       _BV(U2X1)
+#define UART1_UDRE      _BV(UDRE1)
+#define UART1_ENABLE    (_BV(RXCIE1) | _BV(RXEN1)| _BV(TXEN1))
+#define UART1_FORMAT_8N1 (_BV(UCSZ11) | _BV(UCSZ10))
+#define UART1_ERROR_FE  _BV(FE1)
+#define UART1_ERROR_DOR _BV(DOR1)
+#define UART1_TXCIE     _BV(TXCIE1)
+#define UART1_UCSZ2     _BV(UCSZ12)
+#define UART1_TXB8      _BV(TXB81)
+#define UART1_RXB8      _BV(RXB81)
+#define UART1_MPCM      _BV(MPCM1)
+#endif
+
+#if defined(UDRIE2)
+#define UART2_RXC_INT   USART2_RX_vect
+#define UART2_TXC_INT   USART2_TX_vect
+#define UART2_DRE_INT   USART2_UDRE_vect
+#define UART2_STATUS    UCSR2A
+#define UART2_CONTROL   UCSR2B
+#define UART2_FORMAT    UCSR2C
+#define UART2_DATA      UDR2
+#define UART2_UBRRL     UBRR2L
+#define UART2_UBRRH     UBRR2H
+#define UART2_UDRIE     _BV(UDRIE2)
+#define UART2_U2X       _BV(U2X2)
+#define UART2_UDRE      _BV(UDRE2)
+#define UART2_ENABLE    (_BV(RXCIE2) | _BV(RXEN2)| _BV(TXEN2))
+#define UART2_FORMAT_8N1 (_BV(UCSZ21) | _BV(UCSZ20))
+#define UART2_ERROR_FE  _BV(FE2)
+#define UART2_ERROR_DOR _BV(DOR2)
+#define UART2_TXCIE     _BV(TXCIE2)
+#define UART2_UCSZ2     _BV(UCSZ22)
+#define UART2_TXB8      _BV(TXB82)
+#define UART2_RXB8      _BV(RXB82)
+#define UART2_MPCM      _BV(MPCM2)
+#endif
+
+#if defined(UDRIE3)
+#define UART3_RXC_INT   USART3_RX_vect
+#define UART3_TXC_INT   USART3_TX_vect
+#define UART3_DRE_INT   USART3_UDRE_vect
+#define UART3_STATUS    UCSR3A
+#define UART3_CONTROL   UCSR3B
+#define UART3_FORMAT    UCSR3C
+#define UART3_DATA      UDR3
+#define UART3_UBRRL     UBRR3L
+#define UART3_UBRRH     UBRR3H
+#define UART3_UDRIE     _BV(UDRIE3)
+#define UART3_U2X       _BV(U2X3)
+#define UART3_UDRE      _BV(UDRE3)
+#define UART3_ENABLE    (_BV(RXCIE3) | _BV(RXEN3)| _BV(TXEN3))
+#define UART3_FORMAT_8N1 (_BV(UCSZ31) | _BV(UCSZ30))
+#define UART3_ERROR_FE  _BV(FE3)
+#define UART3_ERROR_DOR _BV(DOR3)
+#define UART3_TXCIE     _BV(TXCIE3)
+#define UART3_UCSZ2     _BV(UCSZ32)
+#define UART3_TXB8      _BV(TXB83)
+#define UART3_RXB8      _BV(RXB83)
+#define UART3_MPCM      _BV(MPCM3)
+#endif
+
 #endif /* UART_QUIRKS_H */
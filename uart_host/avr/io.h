@@ -0,0 +1,98 @@
+/*
+    Copyright (c) 2010, Jeremy Cole <jeremy@jcole.us>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Host stand-in for avr-libc's <avr/io.h>, providing the USART registers
+ * of an ATmega644P as plain variables, which are driven by the simulated
+ * USARTs in uart_host.c.
+ */
+
+#ifndef UART_HOST_AVR_IO_H
+#define UART_HOST_AVR_IO_H
+
+#include <inttypes.h>
+
+#define _BV(bit) (1 << (bit))
+
+/* Large enough to never limit the buffers */
+#define RAMEND 0xffff
+
+#define UART_HOST_REGISTERS(n) \
+  extern volatile uint8_t UCSR##n##A, UCSR##n##B, UCSR##n##C, \
+    UDR##n, UBRR##n##H, UBRR##n##L;
+
+UART_HOST_REGISTERS(0)
+UART_HOST_REGISTERS(1)
+
+/* UCSRnA */
+#define RXC0    7
+#define TXC0    6
+#define UDRE0   5
+#define FE0     4
+#define DOR0    3
+#define UPE0    2
+#define U2X0    1
+#define MPCM0   0
+
+/* UCSRnB */
+#define RXCIE0  7
+#define TXCIE0  6
+#define UDRIE0  5
+#define RXEN0   4
+#define TXEN0   3
+#define UCSZ02  2
+#define RXB80   1
+#define TXB80   0
+
+/* UCSRnC */
+#define UCSZ01  2
+#define UCSZ00  1
+
+#define RXC1    7
+#define TXC1    6
+#define UDRE1   5
+#define FE1     4
+#define DOR1    3
+#define UPE1    2
+#define U2X1    1
+#define MPCM1   0
+
+#define RXCIE1  7
+#define TXCIE1  6
+#define UDRIE1  5
+#define RXEN1   4
+#define TXEN1   3
+#define UCSZ12  2
+#define RXB81   1
+#define TXB81   0
+
+#define UCSZ11  2
+#define UCSZ10  1
+
+#define USART0_RX_vect    uart_host_usart0_rx
+#define USART0_UDRE_vect  uart_host_usart0_udre
+#define USART0_TX_vect    uart_host_usart0_tx
+#define USART1_RX_vect    uart_host_usart1_rx
+#define USART1_UDRE_vect  uart_host_usart1_udre
+#define USART1_TX_vect    uart_host_usart1_tx
+
+/* A free-running counter for UART_TIMER_COUNTER, in nanoseconds */
+extern uint16_t uart_host_timer(void);
+
+#endif /* UART_HOST_AVR_IO_H */
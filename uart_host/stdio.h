@@ -0,0 +1,42 @@
+/*
+    Copyright (c) 2010, Jeremy Cole <jeremy@jcole.us>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Host stand-in for avr-libc's <stdio.h> extensions, on top of the host's
+ * own.  Streams set up with fdev_setup_stream() can't be used with the
+ * host's stdio functions, but uart_putchar() and uart_getchar() work on
+ * them directly.
+ */
+
+#include_next <stdio.h>
+
+#ifndef UART_HOST_STDIO_H
+#define UART_HOST_STDIO_H
+
+#define _FDEV_SETUP_READ  1
+#define _FDEV_SETUP_WRITE 2
+#define _FDEV_SETUP_RW    3
+
+#define _FDEV_ERR (-1)
+#define _FDEV_EOF (-2)
+
+#define fdev_setup_stream(stream, put, get, rwflag) \
+  ((void)(stream), (void)(put), (void)(get), (void)(rwflag))
+
+#endif /* UART_HOST_STDIO_H */
@@ -0,0 +1,171 @@
+/*
+    Copyright (c) 2010, Jeremy Cole <jeremy@jcole.us>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Tests of the baud rate selection done by UART_BAUD_AUTO() at compile time
+ * and by uart_baud_select() at run time.  A sweep of common clock and baud
+ * rate pairs is checked against the UBRR and U2X setting, and its error,
+ * worked out independently in floating point, and a few pairs known to be
+ * marginal are checked by name.
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include "uart.h"
+
+static int failures;
+
+#define CHECK(condition) \
+  do { \
+    if(!(condition)) \
+    { \
+      printf("  %s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      failures++; \
+    } \
+  } while(0)
+
+static const uint32_t clocks[] = {
+  1000000, 1843200, 3686400, 4000000, 7372800, 8000000, 11059200,
+  12000000, 14745600, 16000000, 18432000, 20000000,
+};
+
+static const uint32_t bauds[] = {
+  300, 1200, 2400, 4800, 9600, 14400, 19200, 28800, 38400, 57600,
+  76800, 115200, 230400, 250000, 500000, 1000000,
+};
+
+/*
+ * The error in tenths of a percent, truncated, for samples per bit at the
+ * nearest UBRR, or 1000 if that UBRR is out of range or the error over
+ * 6.25%.  The UBRR is returned in *ubrr.
+ */
+static unsigned int reference_error(uint32_t baud, uint32_t xtal_cpu,
+                                    unsigned int samples, unsigned int *ubrr)
+{
+  double actual, error;
+
+  *ubrr = (unsigned int)floor((double)xtal_cpu / (samples * baud) + 0.5) - 1;
+  if(*ubrr > UART_UBRR_MAX)
+    return 1000;
+
+  actual = (double)xtal_cpu / (samples * (*ubrr + 1.0));
+  error = fabs(actual - baud) / baud;
+  if(error > 1.0 / 16)
+    return 1000;
+
+  return (unsigned int)floor(error * 1000);
+}
+
+/*
+ * The setting uart_init() should choose: the lower error of normal and
+ * double speed, preferring normal speed, if within UART_BAUD_TOLERANCE.
+ */
+static unsigned int reference_setting(uint32_t baud, uint32_t xtal_cpu)
+{
+  unsigned int ubrr_normal, ubrr_double;
+  unsigned int error_normal, error_double;
+
+  error_normal = reference_error(baud, xtal_cpu, 16, &ubrr_normal);
+  error_double = reference_error(baud, xtal_cpu, 8, &ubrr_double);
+
+  if(error_double < error_normal)
+    return error_double > UART_BAUD_TOLERANCE
+      ? UART_BAUD_INVALID : (ubrr_double | UART_BAUD_RATE_2X);
+
+  return error_normal > UART_BAUD_TOLERANCE
+    ? UART_BAUD_INVALID : ubrr_normal;
+}
+
+/*
+ * Check uart_baud_select() against the reference for every pair in the
+ * sweep, printing any which differ.
+ */
+static void test_sweep(void)
+{
+  unsigned int c, b;
+  unsigned int expected, selected;
+  unsigned int accepted = 0, rejected = 0;
+
+  printf("test_sweep\n");
+
+  for(c=0; c < sizeof(clocks) / sizeof(clocks[0]); c++)
+  {
+    for(b=0; b < sizeof(bauds) / sizeof(bauds[0]); b++)
+    {
+      expected = reference_setting(bauds[b], clocks[c]);
+      selected = uart_baud_select(bauds[b], clocks[c]);
+
+      if(selected != expected)
+      {
+        printf("  %8lu Hz %7lu bps: selected %04x, expected %04x\n",
+          (unsigned long)clocks[c], (unsigned long)bauds[b],
+          selected, expected);
+        failures++;
+      }
+
+      if(selected == UART_BAUD_INVALID)
+        rejected++;
+      else
+        accepted++;
+    }
+  }
+
+  printf("  %u pairs accepted, %u rejected\n", accepted, rejected);
+}
+
+/*
+ * Pairs which a naive choice of UBRR gets wrong, checked with constant
+ * arguments, as uart_init() uses them at compile time.
+ */
+static void test_marginal(void)
+{
+  printf("test_marginal\n");
+
+  /* 3.5% at normal speed, 2.1% at double speed */
+  CHECK(UART_BAUD_AUTO(57600, 8000000UL) == UART_BAUD_INVALID);
+  CHECK(UART_BAUD_ERROR(57600, 8000000UL, 8) == 21);
+
+  /* 3.5% either way */
+  CHECK(UART_BAUD_AUTO(115200, 8000000UL) == UART_BAUD_INVALID);
+
+  /* 1.3% either way, so normal speed is preferred */
+  CHECK(UART_BAUD_AUTO(115200, 20000000UL) == 10);
+  CHECK(UART_BAUD_ERROR(115200, 20000000UL, 16) == 13);
+
+  /* Exact at both speeds, and at double speed only */
+  CHECK(UART_BAUD_AUTO(57600, 14745600UL) == 15);
+  CHECK(UART_BAUD_AUTO(1000000, 8000000UL) == (0 | UART_BAUD_RATE_2X));
+
+  /* 300 bps needs a UBRR over 4095 at 20 MHz, which is out of range */
+  CHECK(UART_BAUD_AUTO(300, 20000000UL) == UART_BAUD_INVALID);
+  CHECK(UART_BAUD_AUTO(300, 1000000UL) == (416 | UART_BAUD_RATE_2X));
+
+  CHECK(uart_baud_select(0, 20000000UL) == UART_BAUD_INVALID);
+}
+
+int main(void)
+{
+  test_sweep();
+  test_marginal();
+
+  printf(failures ? "%d checks failed\n" : "All tests passed\n", failures);
+
+  return failures ? 1 : 0;
+}
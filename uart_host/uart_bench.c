@@ -0,0 +1,384 @@
+/*
+    Copyright (c) 2010, Jeremy Cole <jeremy@jcole.us>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Throughput benchmark for the UART library, run against the simulated
+ * USARTs of uart_host.c.  For a range of bit rates, buffer sizes, and
+ * consumer latencies (the time between the application's reads), it
+ * reports how much received data is lost to buffer overflow, the fastest
+ * bit rate sustainable without loss, how much of a periodic burst of output
+ * would have to wait for buffer space, and the host time spent in each ISR,
+ * including a comparison of the ISRs' dispatch through uart_instances[]
+ * against the list search it replaced.
+ *
+ * The library is built with the largest buffers, and each run limits them
+ * to the size under test by shrinking their masks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "uart.h"
+#include "uart_host.h"
+
+#define BENCH_RX_BYTES  20000
+#define BENCH_TX_PERIODS 100
+#define BENCH_DISPATCH_CALLS 1000000
+#define BENCH_DISPATCH_RUNS 5
+
+#define ELEMENTS(a) (sizeof(a) / sizeof((a)[0]))
+
+static const uint32_t bauds[] = { 9600, 38400, 115200, 250000, 500000 };
+static const uint16_t sizes[] = { 16, 32, 64, 128, 256, 512, 1024 };
+static const uint32_t latencies_us[] = { 100, 1000, 5000, 10000, 50000 };
+static const uint16_t bursts[] = { 16, 64, 128, 256, 512 };
+
+static unsigned char pattern[BENCH_RX_BYTES];
+
+#define US_TO_CYCLES(us) ((uint64_t)(us) * (F_CPU / 1000000))
+
+/*
+ * Initialize UART0 at baud with buffers limited to rx_size and tx_size,
+ * or return NULL if baud can't be generated from F_CPU.
+ */
+static uart_t *bench_uart(uint32_t baud, uint16_t rx_size, uint16_t tx_size)
+{
+  uart_t *uart;
+
+  uart_host_reset();
+
+  uart = uart_init("0", baud);
+  if(!uart)
+    return NULL;
+
+  uart->rx.mask = rx_size - 1;
+  uart->tx.mask = tx_size - 1;
+  uart_reset_statistics(uart);
+
+  /* Settle the simulated status registers after initialization */
+  uart_host_run(0);
+
+  return uart;
+}
+
+/*
+ * Receive BENCH_RX_BYTES back-to-back, reading everything available once
+ * every latency_us.  Returns the number of bytes lost, or -1 if baud isn't
+ * available.
+ */
+static long bench_rx(uint32_t baud, uint16_t size, uint32_t latency_us,
+    uart_statistics_t *statistics)
+{
+  uart_t *uart;
+  uart_error_counters_t errors;
+  unsigned char buffer[64];
+  uint32_t received = 0;
+  uint16_t count;
+
+  if(!(uart = bench_uart(baud, size, 32)))
+    return -1;
+
+  uart_host_receive(0, pattern, sizeof(pattern));
+
+  while(uart_host_usarts[0].rx_position < sizeof(pattern)
+      || uart_data_ready(uart))
+  {
+    uart_host_run(US_TO_CYCLES(latency_us));
+    while((count = uart_read(uart, buffer, sizeof(buffer))))
+      received += count;
+  }
+
+  uart_get_error_counters(uart, &errors);
+  if(received + errors.overflow != sizeof(pattern))
+  {
+    fprintf(stderr, "bench_rx: %u received + %u lost != %u sent\n",
+        received, errors.overflow, (unsigned)sizeof(pattern));
+    exit(1);
+  }
+
+  if(statistics)
+    uart_get_statistics(uart, statistics);
+
+  return errors.overflow;
+}
+
+/*
+ * Write a burst of burst bytes once every period_us, without blocking.
+ * Returns the number of bytes which would have had to wait for space.
+ */
+static long bench_tx(uint32_t baud, uint16_t size, uint16_t burst,
+    uint32_t period_us, uart_statistics_t *statistics)
+{
+  uart_t *uart;
+  uint32_t waiting = 0;
+  uint16_t period;
+
+  if(!(uart = bench_uart(baud, 32, size)))
+    return -1;
+
+  for(period = 0; period < BENCH_TX_PERIODS; period++)
+  {
+    waiting += burst - uart_write_nonblocking(uart, pattern, burst);
+    uart_host_run(US_TO_CYCLES(period_us));
+  }
+
+  /* Let the rest drain */
+  uart_host_run(US_TO_CYCLES(1000000));
+
+  if(statistics)
+    uart_get_statistics(uart, statistics);
+
+  return waiting;
+}
+
+static void print_rx_loss(uint32_t baud)
+{
+  uint8_t s, l;
+  long lost;
+
+  printf("\nRX loss at %lu bps (%% of %u bytes lost; rows: buffer size,"
+      " columns: read latency):\n", (unsigned long)baud, BENCH_RX_BYTES);
+  printf("%8s", "");
+  for(l = 0; l < ELEMENTS(latencies_us); l++)
+    printf(" %7.1fms", latencies_us[l] / 1000.0);
+  printf("\n");
+
+  for(s = 0; s < ELEMENTS(sizes); s++)
+  {
+    printf("%8u", sizes[s]);
+    for(l = 0; l < ELEMENTS(latencies_us); l++)
+    {
+      lost = bench_rx(baud, sizes[s], latencies_us[l], NULL);
+      printf(" %8.1f%%", 100.0 * lost / BENCH_RX_BYTES);
+    }
+    printf("\n");
+  }
+}
+
+static void print_rx_sustainable(void)
+{
+  uint8_t s, l, b;
+  uint32_t best;
+
+  printf("\nFastest bps received without loss (rows: buffer size,"
+      " columns: read latency):\n");
+  printf("%8s", "");
+  for(l = 0; l < ELEMENTS(latencies_us); l++)
+    printf(" %7.1fms", latencies_us[l] / 1000.0);
+  printf("\n");
+
+  for(s = 0; s < ELEMENTS(sizes); s++)
+  {
+    printf("%8u", sizes[s]);
+    for(l = 0; l < ELEMENTS(latencies_us); l++)
+    {
+      best = 0;
+      for(b = 0; b < ELEMENTS(bauds); b++)
+        if(bench_rx(bauds[b], sizes[s], latencies_us[l], NULL) == 0)
+          best = bauds[b];
+      if(best)
+        printf(" %9lu", (unsigned long)best);
+      else
+        printf(" %9s", "-");
+    }
+    printf("\n");
+  }
+}
+
+static void print_tx_waiting(uint32_t baud, uint32_t period_us)
+{
+  uint8_t s, b;
+  long waiting;
+
+  printf("\nTX waits at %lu bps, a burst every %.1fms (%% of bytes"
+      " waiting for space; rows: buffer size, columns: burst size):\n",
+      (unsigned long)baud, period_us / 1000.0);
+  printf("%8s", "");
+  for(b = 0; b < ELEMENTS(bursts); b++)
+    printf(" %9u", bursts[b]);
+  printf("\n");
+
+  for(s = 0; s < ELEMENTS(sizes); s++)
+  {
+    printf("%8u", sizes[s]);
+    for(b = 0; b < ELEMENTS(bursts); b++)
+    {
+      waiting = bench_tx(baud, sizes[s], bursts[b], period_us, NULL);
+      printf(" %8.1f%%", 100.0 * waiting / ((long)bursts[b] * BENCH_TX_PERIODS));
+    }
+    printf("\n");
+  }
+}
+
+static void print_isr_cost(void)
+{
+  uart_statistics_t statistics;
+
+  printf("\nHost time per ISR call (ns, including timer overhead):\n");
+
+  bench_rx(500000, 1024, 100, &statistics);
+  printf("  RX complete:         mean %6.1f, max %5u\n",
+      (double)statistics.rxc_time.total / statistics.rx_bytes,
+      statistics.rxc_time.max);
+
+  bench_tx(500000, 1024, 512, 10000, &statistics);
+  printf("  Data register empty: mean %6.1f, max %5u\n",
+      (double)statistics.dre_time.total / statistics.tx_bytes,
+      statistics.dre_time.max);
+}
+
+/*
+ * The ISR dispatch which uart_instances[] replaced: each ISR found its
+ * uart_t by name, walking a list of the UARTs in the order initialized.
+ */
+typedef struct _bench_instance_t
+{
+  uart_t *uart;
+  struct _bench_instance_t *next;
+} bench_instance_t;
+
+static bench_instance_t bench_instances[UART_COUNT];
+
+static uart_t *bench_list_by_name(char *name)
+{
+  bench_instance_t *instance;
+
+  for(instance = bench_instances; instance; instance = instance->next)
+  {
+    if(!(strcmp(instance->uart->description->name, name)))
+      return instance->uart;
+  }
+  return NULL;
+}
+
+static double bench_now_ns(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+/*
+ * Read through volatiles on each call, as each interrupt would, so that the
+ * compiler can't hoist the lookup out of the loop.
+ */
+static char * volatile bench_name;
+static volatile uint8_t bench_index;
+static uart_t * volatile bench_sink;
+
+#define BENCH_DISPATCH_NONE  0
+#define BENCH_DISPATCH_TABLE 1
+#define BENCH_DISPATCH_LIST  2
+
+/*
+ * Find UART n's uart_t BENCH_DISPATCH_CALLS times, as its RX complete ISR
+ * would on entry: from uart_instances[] as the ISRs do now, from the list
+ * by name as they did before, or not at all, for the loop's own cost.  The
+ * ISR body isn't run, since with UART_STATISTICS its timing calls cost far
+ * more than the lookup and would hide the difference.  Returns the least
+ * mean host time per call over BENCH_DISPATCH_RUNS runs, in nanoseconds.
+ */
+static double bench_dispatch(uint8_t n, uint8_t method)
+{
+  double start, elapsed, best = 0;
+  uint32_t i;
+  uint8_t run;
+
+  bench_name = uart_instances[n]->description->name;
+  bench_index = n;
+
+  for(run = 0; run < BENCH_DISPATCH_RUNS; run++)
+  {
+    start = bench_now_ns();
+    for(i = 0; i < BENCH_DISPATCH_CALLS; i++)
+    {
+      switch(method)
+      {
+      case BENCH_DISPATCH_LIST:
+        bench_sink = bench_list_by_name(bench_name);
+        break;
+      case BENCH_DISPATCH_TABLE:
+        bench_sink = uart_instances[bench_index];
+        break;
+      default:
+        bench_sink = (uart_t *)(uintptr_t)bench_index;
+        break;
+      }
+    }
+    elapsed = (bench_now_ns() - start) / BENCH_DISPATCH_CALLS;
+
+    if(run == 0 || elapsed < best)
+      best = elapsed;
+  }
+
+  return best;
+}
+
+static void print_dispatch_cost(void)
+{
+  uint8_t n;
+  double none, by_name, by_index;
+
+  uart_host_reset();
+  for(n = 0; n < UART_COUNT; n++)
+  {
+    bench_instances[n].uart = uart_init(uart_descriptions[n].name, 115200);
+    bench_instances[n].next =
+      (n + 1 < UART_COUNT) ? &bench_instances[n + 1] : NULL;
+  }
+
+  printf("\nISR dispatch, host time to find the uart_t per interrupt (ns, best"
+      " mean of %u runs of %u, less loop overhead):\n",
+      BENCH_DISPATCH_RUNS, BENCH_DISPATCH_CALLS);
+  printf("%8s %12s %12s %12s\n", "", "list+strcmp", "table", "saved");
+
+  for(n = 0; n < UART_COUNT; n++)
+  {
+    none = bench_dispatch(n, BENCH_DISPATCH_NONE);
+    by_name = bench_dispatch(n, BENCH_DISPATCH_LIST) - none;
+    by_index = bench_dispatch(n, BENCH_DISPATCH_TABLE) - none;
+    printf("  UART%u  %12.2f %12.2f %12.2f\n",
+        n, by_name, by_index, by_name - by_index);
+  }
+}
+
+int main(void)
+{
+  uint32_t i;
+  uint8_t b;
+
+  for(i = 0; i < sizeof(pattern); i++)
+    pattern[i] = i;
+
+  printf("UART library benchmark, simulated F_CPU %lu Hz, 8N1 frames\n",
+      (unsigned long)F_CPU);
+
+  for(b = 0; b < ELEMENTS(bauds); b++)
+    print_rx_loss(bauds[b]);
+
+  print_rx_sustainable();
+  print_tx_waiting(115200, 10000);
+  print_isr_cost();
+  print_dispatch_cost();
+
+  return 0;
+}
@@ -0,0 +1,192 @@
+/*
+    Copyright (c) 2010, Jeremy Cole <jeremy@jcole.us>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+ * Tests of bridging a UART in line mode to another, as gps_i2c does with
+ * GPS_PASSTHROUGH, run against the simulated USARTs of uart_host.c.  UART1
+ * receives lines and is bridged to UART0, whose transmit buffer can be
+ * filled by running it at a low bit rate.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "uart.h"
+#include "uart_host.h"
+
+static int failures;
+
+#define CHECK(condition) \
+  do { \
+    if(!(condition)) \
+    { \
+      printf("  %s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      failures++; \
+    } \
+  } while(0)
+
+static uart_t *u0;
+static uart_t *u1;
+
+/* Everything UART0 has transmitted since the last test_setup() */
+static unsigned char sent[4096];
+static uint32_t sent_length;
+
+static void record_sent(uint8_t n, unsigned char data)
+{
+  if(sent_length < sizeof(sent))
+    sent[sent_length++] = data;
+}
+
+/*
+ * Start from power on, with UART1 in line mode bridged to UART0.
+ */
+static void test_setup(const char *name, uint32_t baud_rate, uint8_t flags)
+{
+  printf("%s\n", name);
+
+  uart_host_reset();
+  u0 = uart_init("0", baud_rate);
+  u1 = uart_init("1", 115200);
+  uart_host_usarts[0].tx_sink = record_sent;
+  sent_length = 0;
+
+  uart_set_line_mode(u1, '\n');
+  uart_set_bridge(u1, u0, flags);
+  uart_host_run(1);
+}
+
+/*
+ * Receive a line on UART1, and wait for it to arrive.
+ */
+static void receive_line(const char *line)
+{
+  uart_host_receive(1, (const unsigned char *)line, strlen(line));
+  uart_host_run(uart_host_frame_cycles(1) * (strlen(line) + 1));
+}
+
+/*
+ * Whether UART0 has just transmitted line.
+ */
+static int sent_last(const char *line)
+{
+  uint32_t length = strlen(line);
+
+  return sent_length >= length
+    && memcmp(&sent[sent_length - length], line, length) == 0;
+}
+
+/*
+ * Lines are forwarded in order, and may still be read locally.
+ */
+static void test_tee_forwarded(void)
+{
+  char *line;
+  uint16_t length;
+
+  test_setup("test_tee_forwarded", 115200, UART_BRIDGE_TEE);
+
+  receive_line("$GPRMC,1\n");
+  CHECK(uart_bridge_pump(u1) == 9);
+  line = uart_line_get(u1, &length);
+  CHECK(line && length == 9 && strcmp(line, "$GPRMC,1\n") == 0);
+  uart_line_release(u1);
+
+  /* With two slots, the second line is held in the other one */
+  receive_line("$GPGGA,2\n");
+  CHECK(uart_bridge_pump(u1) == 9);
+  CHECK(uart_bridge_pump(u1) == 0);
+  line = uart_line_get(u1, &length);
+  CHECK(line && strcmp(line, "$GPGGA,2\n") == 0);
+  uart_line_release(u1);
+
+  uart_host_run(uart_host_frame_cycles(0) * 20);
+  CHECK(sent_length == 18);
+  CHECK(sent_last("$GPRMC,1\n$GPGGA,2\n"));
+  CHECK(u1->bridge.dropped == 0);
+}
+
+/*
+ * A line the application releases while UART0's transmit buffer is full is
+ * counted as dropped, and the next line is still forwarded.
+ */
+static void test_tee_released_line(void)
+{
+  static unsigned char filler[1024];
+  uint16_t length;
+  uint32_t slow_frame;
+
+  test_setup("test_tee_released_line", 2400, UART_BRIDGE_TEE);
+
+  memset(filler, '.', sizeof(filler));
+  while(uart_tx_free(u0))
+    uart_write_nonblocking(u0, filler, uart_tx_free(u0));
+
+  receive_line("$GPRMC,1\n");
+  CHECK(uart_bridge_pump(u1) == 0);
+
+  /* Read and released before the bridge could forward it */
+  CHECK(uart_line_get(u1, &length) != NULL);
+  uart_line_release(u1);
+
+  receive_line("$GPGGA,2\n");
+
+  /* Drain UART0 at a higher bit rate, after the bytes already started */
+  slow_frame = uart_host_frame_cycles(0);
+  uart_set_baudrate(u0, UART_BAUD_AUTO(115200, F_CPU));
+  uart_host_run(slow_frame * 2 + uart_host_frame_cycles(0) * sizeof(filler));
+  CHECK(uart_tx_free(u0) == u0->tx.mask);
+
+  CHECK(uart_bridge_pump(u1) == 9);
+  CHECK(u1->bridge.dropped == 1);
+  uart_host_run(uart_host_frame_cycles(0) * 10);
+  CHECK(sent_last("$GPRMC,1\n") == 0);
+  CHECK(sent_last("...$GPGGA,2\n"));
+
+  /* The forwarded line remains to be read */
+  CHECK(uart_line_get(u1, &length) != NULL && length == 9);
+}
+
+/*
+ * Without UART_BRIDGE_TEE, the bridge consumes the lines it forwards.
+ */
+static void test_consumed(void)
+{
+  test_setup("test_consumed", 115200, 0);
+
+  receive_line("$GPRMC,1\n");
+  CHECK(uart_bridge_pump(u1) == 9);
+  CHECK(uart_line_get(u1, NULL) == NULL);
+  receive_line("$GPGGA,2\n");
+  CHECK(uart_bridge_pump(u1) == 9);
+  CHECK(uart_line_get(u1, NULL) == NULL);
+  uart_host_run(uart_host_frame_cycles(0) * 20);
+  CHECK(sent_last("$GPRMC,1\n$GPGGA,2\n"));
+}
+
+int main(void)
+{
+  test_tee_forwarded();
+  test_tee_released_line();
+  test_consumed();
+
+  printf(failures ? "%d checks failed\n" : "All tests passed\n", failures);
+
+  return failures ? 1 : 0;
+}
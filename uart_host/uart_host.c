@@ -0,0 +1,244 @@
+/*
+    Copyright (c) 2010, Jeremy Cole <jeremy@jcole.us>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "uart_host.h"
+
+#define UART_HOST_REGISTER_STORAGE(n) \
+  volatile uint8_t UCSR##n##A, UCSR##n##B, UCSR##n##C, \
+    UDR##n, UBRR##n##H, UBRR##n##L;
+
+UART_HOST_REGISTER_STORAGE(0)
+UART_HOST_REGISTER_STORAGE(1)
+
+#define UART_HOST_USART(n) \
+  { &UCSR##n##A, &UCSR##n##B, &UDR##n, &UBRR##n##H, &UBRR##n##L, \
+    USART##n##_RX_vect, USART##n##_UDRE_vect, USART##n##_TX_vect }
+
+uart_host_usart_t uart_host_usarts[UART_COUNT];
+
+static const uart_host_usart_t uart_host_usart_registers[UART_COUNT] = {
+  UART_HOST_USART(0),
+  UART_HOST_USART(1),
+};
+
+uint64_t uart_host_now;
+
+uint16_t uart_host_timer(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint16_t)now.tv_nsec;
+}
+
+/*
+ * Reset the simulated USARTs and time, as at power on.
+ */
+void uart_host_reset(void)
+{
+  uint8_t n;
+
+  uart_host_now = 0;
+  memcpy(uart_host_usarts, uart_host_usart_registers, sizeof(uart_host_usarts));
+
+  for(n = 0; n < UART_COUNT; n++)
+  {
+    *uart_host_usarts[n].status = _BV(UDRE0);
+    *uart_host_usarts[n].control = 0;
+    *uart_host_usarts[n].ubrrh = 0;
+    *uart_host_usarts[n].ubrrl = 0;
+  }
+}
+
+/*
+ * The number of CPU cycles taken to send or receive one 8N1 frame at the
+ * bit rate currently set for USART n.
+ */
+uint32_t uart_host_frame_cycles(uint8_t n)
+{
+  uart_host_usart_t *usart = &uart_host_usarts[n];
+  uint32_t ubrr = ((uint32_t)(*usart->ubrrh & 0x0f) << 8) | *usart->ubrrl;
+
+  return 10 * ((*usart->status & _BV(U2X0)) ? 8 : 16) * (ubrr + 1);
+}
+
+/*
+ * Have the peer send length bytes of data to USART n, back-to-back, with
+ * the first arriving one frame from now.  data must remain valid until all
+ * of it has arrived.
+ */
+void uart_host_receive(uint8_t n, const unsigned char *data, uint32_t length)
+{
+  uart_host_usart_t *usart = &uart_host_usarts[n];
+
+  usart->rx_data = data;
+  usart->rx_length = length;
+  usart->rx_position = 0;
+  usart->rx_next = uart_host_now + uart_host_frame_cycles(n);
+}
+
+/*
+ * Called by uart.c in place of writing to a data register, to transmit a
+ * byte: directly into the shift register if idle, otherwise into the holding
+ * register, clearing UDRE until it moves on.
+ */
+void uart_host_write(volatile uint8_t *data_register, uint8_t data)
+{
+  uart_host_usart_t *usart;
+  uint8_t n;
+
+  for(n = 0; n < UART_COUNT; n++)
+    if(uart_host_usarts[n].data == data_register)
+      break;
+  if(n == UART_COUNT)
+    abort();
+  usart = &uart_host_usarts[n];
+
+  *usart->status &= ~_BV(TXC0);
+
+  if(!usart->tx_shifting)
+  {
+    usart->tx_shifting = 1;
+    usart->tx_done = uart_host_now + uart_host_frame_cycles(n);
+    if(usart->tx_sink)
+      usart->tx_sink(n, data);
+    return;
+  }
+
+  /* The holding register is only written while UDRE is set */
+  if(usart->tx_holding_full)
+    abort();
+
+  usart->tx_holding_full = 1;
+  usart->tx_holding = data;
+  *usart->status &= ~_BV(UDRE0);
+}
+
+/*
+ * Call the ISRs for any interrupts now pending on USART n.  Data register
+ * empty is a level interrupt, so its ISR is called until it either fills
+ * the holding register or disables the interrupt.
+ */
+static void uart_host_interrupts(uart_host_usart_t *usart)
+{
+  uint8_t calls = 0;
+
+  /* UDRE can't be cleared by writing the status register */
+  if(!usart->tx_holding_full)
+    *usart->status |= _BV(UDRE0);
+
+  while((*usart->control & _BV(UDRIE0)) && (*usart->status & _BV(UDRE0)))
+  {
+    /* An ISR which neither sends nor disables would hang the hardware */
+    if(++calls > 2)
+      abort();
+    usart->dre();
+  }
+
+  if((*usart->control & _BV(TXCIE0)) && (*usart->status & _BV(TXC0)))
+  {
+    /* Calling the ISR clears TXC */
+    *usart->status &= ~_BV(TXC0);
+    usart->txc();
+  }
+}
+
+/*
+ * Complete the receive or transmit events of USART n due at time.
+ */
+static void uart_host_events(uint8_t n, uint64_t time)
+{
+  uart_host_usart_t *usart = &uart_host_usarts[n];
+
+  if(usart->rx_position < usart->rx_length && usart->rx_next == time)
+  {
+    usart->rx_next += uart_host_frame_cycles(n);
+    if(*usart->control & _BV(RXEN0))
+    {
+      *usart->data = usart->rx_data[usart->rx_position];
+      if(*usart->control & _BV(RXCIE0))
+        usart->rxc();
+    }
+    usart->rx_position++;
+  }
+
+  if(usart->tx_shifting && usart->tx_done == time)
+  {
+    usart->tx_count++;
+    if(usart->tx_holding_full)
+    {
+      /* The holding register moves on to the shift register */
+      usart->tx_holding_full = 0;
+      usart->tx_done += uart_host_frame_cycles(n);
+      *usart->status |= _BV(UDRE0);
+      if(usart->tx_sink)
+        usart->tx_sink(n, usart->tx_holding);
+    }
+    else
+    {
+      usart->tx_shifting = 0;
+      *usart->status |= _BV(TXC0);
+    }
+  }
+
+  uart_host_interrupts(usart);
+}
+
+/*
+ * Advance simulated time by cycles, calling the ISRs as the simulated
+ * USARTs raise interrupts.  Interrupts already pending (such as UDRE after
+ * data was queued) are taken immediately.
+ */
+void uart_host_run(uint64_t cycles)
+{
+  uint64_t end = uart_host_now + cycles;
+  uint64_t next;
+  uart_host_usart_t *usart;
+  uint8_t n;
+
+  for(n = 0; n < UART_COUNT; n++)
+    uart_host_interrupts(&uart_host_usarts[n]);
+
+  for(;;)
+  {
+    /* Find the next event due on any USART */
+    next = end;
+    for(n = 0; n < UART_COUNT; n++)
+    {
+      usart = &uart_host_usarts[n];
+      if(usart->rx_position < usart->rx_length && usart->rx_next < next)
+        next = usart->rx_next;
+      if(usart->tx_shifting && usart->tx_done < next)
+        next = usart->tx_done;
+    }
+
+    uart_host_now = next;
+    for(n = 0; n < UART_COUNT; n++)
+      uart_host_events(n, next);
+
+    if(next == end)
+      break;
+  }
+}
@@ -0,0 +1,70 @@
+/*
+    Copyright (c) 2010, Jeremy Cole <jeremy@jcole.us>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+#ifndef UART_HOST_H
+#define UART_HOST_H
+
+#include <inttypes.h>
+
+#include "uart.h"
+
+/*
+ * A simulated USART, driven by simulated time counted in CPU cycles (of
+ * F_CPU).  Its bit rate is taken from its UBRR and U2X settings, as on the
+ * hardware, with 10-bit (8N1) frames.  Received bytes arrive back-to-back
+ * from the peer, and each byte written to the data register is transmitted
+ * through a holding register and a shift register, setting UDRE and TXC as
+ * the hardware does.  The ISRs are called as each interrupt becomes due.
+ */
+typedef struct _uart_host_usart_t
+{
+  volatile uint8_t *status;
+  volatile uint8_t *control;
+  volatile uint8_t *data;
+  volatile uint8_t *ubrrh;
+  volatile uint8_t *ubrrl;
+  void (*rxc)(void);
+  void (*dre)(void);
+  void (*txc)(void);
+
+  const unsigned char *rx_data;
+  uint32_t rx_length;
+  uint32_t rx_position;
+  uint64_t rx_next;
+
+  uint8_t tx_holding_full;
+  unsigned char tx_holding;
+  uint8_t tx_shifting;
+  uint64_t tx_done;
+  uint32_t tx_count;
+  void (*tx_sink)(uint8_t n, unsigned char data);
+} uart_host_usart_t;
+
+extern uart_host_usart_t uart_host_usarts[UART_COUNT];
+
+/** Simulated time, in CPU cycles */
+extern uint64_t uart_host_now;
+
+extern void uart_host_reset(void);
+extern uint32_t uart_host_frame_cycles(uint8_t n);
+extern void uart_host_receive(uint8_t n, const unsigned char *data, uint32_t length);
+extern void uart_host_run(uint64_t cycles);
+extern void uart_host_write(volatile uint8_t *data_register, uint8_t data);
+
+#endif /* UART_HOST_H */
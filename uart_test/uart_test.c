@@ -51,14 +51,43 @@ void uart_dump()
   }
 }
 
+#if UART_STATISTICS
+void uart_statistics_dump(uart_t *uart)
+{
+  uart_statistics_t s;
+  uart_error_counters_t e;
+
+  uart_get_statistics(uart, &s);
+  uart_get_error_counters(uart, &e);
+
+  printf("UART: %s\n", uart->description->name);
+  printf("  rx_bytes: %lu    rx_peak: %u/%u\n",
+      (unsigned long)s.rx_bytes,
+      (unsigned int)s.rx_peak,
+      (unsigned int)uart->rx.mask);
+  printf("  tx_bytes: %lu    tx_peak: %u/%u    tx_waits: %u\n",
+      (unsigned long)s.tx_bytes,
+      (unsigned int)s.tx_peak,
+      (unsigned int)uart->tx.mask,
+      s.tx_waits);
+  printf("  rxc_time: %lu    max: %u\n",
+      (unsigned long)s.rxc_time.total, s.rxc_time.max);
+  printf("  dre_time: %lu    max: %u\n",
+      (unsigned long)s.dre_time.total, s.dre_time.max);
+  printf("  errors:   frame: %u    overrun: %u    overflow: %u\n",
+      e.frame, e.overrun, e.overflow);
+  printf("\n");
+}
+#endif
+
 int main(void)
 {
   uart_t *u0;
   //uart_t *u1;
   _delay_ms(1000);
 
-  u0 = uart_init("0", UART_BAUD_SELECT(9600, F_CPU));
-  //u1 = uart_init("1", 0);
+  u0 = uart_init("0", 9600);
+  //u1 = uart_init("1", 9600);
   uart_init_stdout(u0);
 
   sei();
@@ -67,8 +96,25 @@ int main(void)
 
   uart_dump();
 
+#if UART_STATISTICS
+  /*
+   * Time the ISRs in CPU cycles if the library was built with
+   * UART_TIMER_COUNTER=TCNT1, and dump the statistics next to the UART
+   * descriptions whenever 's' is received.
+   */
+  TCCR1A = 0;
+  TCCR1B = _BV(CS10);
+#endif
+
   while(1)
   {
+#if UART_STATISTICS
+    if((uart_getc(u0) & 0xff) == 's')
+    {
+      uart_dump();
+      uart_statistics_dump(u0);
+    }
+#endif
     uart_puts(u0, "Test on UART 0!\r\n");
     //uart_puts(u1, "Test on UART 1!\r\n");
     _delay_ms(100);